@@ -0,0 +1,71 @@
+#include <cstddef>
+
+#include <benchmark/benchmark.h>
+
+#include "socow-chunked-vector.h"
+#include "socow-vector.h"
+
+// socow_chunked_vector against socow_vector on the operations the chunks
+// trade off: writing into a shared copy, random reads and iteration.
+
+namespace {
+
+using flat = socow_vector<int, 4>;
+using chunked = socow_chunked_vector<int>;
+
+template <typename Vector>
+Vector filled(size_t n) {
+  Vector v;
+  for (size_t i = 0; i != n; ++i) {
+    v.push_back(static_cast<int>(i));
+  }
+  return v;
+}
+
+// Copies a large vector and writes one element of the copy.
+template <typename Vector>
+void write_after_share(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0));
+  Vector const source = filled<Vector>(n);
+  size_t i = 0;
+  for (auto _ : state) {
+    Vector copy = source;
+    copy[i] = 1;
+    i = (i + 7919) % n;
+    benchmark::DoNotOptimize(&copy);
+  }
+}
+
+template <typename Vector>
+void random_reads(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0));
+  Vector const v = filled<Vector>(n);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(v[i]);
+    i = (i + 7919) % n;
+  }
+}
+
+template <typename Vector>
+void iterate(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0));
+  Vector const v = filled<Vector>(n);
+  for (auto _ : state) {
+    long sum = 0;
+    for (int value : v) {
+      sum += value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(write_after_share, flat)->Range(1 << 10, 10 << 20);
+BENCHMARK_TEMPLATE(write_after_share, chunked)->Range(1 << 10, 10 << 20);
+BENCHMARK_TEMPLATE(random_reads, flat)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(random_reads, chunked)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(iterate, flat)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(iterate, chunked)->Arg(1 << 20);
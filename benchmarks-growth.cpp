@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <benchmark/benchmark.h>
+
+#include "socow-vector.h"
+
+namespace {
+
+// Tracks the heap bytes held by the vectors being measured, so that every
+// benchmark can report its peak footprint next to its speed.
+struct heap_usage {
+  static inline size_t live_bytes = 0;
+  static inline size_t peak_bytes = 0;
+  static inline size_t allocations = 0;
+
+  static void reset() {
+    live_bytes = 0;
+    peak_bytes = 0;
+    allocations = 0;
+  }
+};
+
+template <typename T>
+struct tracking_allocator {
+  using value_type = T;
+
+  tracking_allocator() noexcept = default;
+
+  template <typename U>
+  tracking_allocator(tracking_allocator<U> const&) noexcept {}
+
+  T* allocate(size_t n) {
+    heap_usage::live_bytes += sizeof(T) * n;
+    heap_usage::peak_bytes =
+        std::max(heap_usage::peak_bytes, heap_usage::live_bytes);
+    ++heap_usage::allocations;
+    return socow_allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    heap_usage::live_bytes -= sizeof(T) * n;
+    socow_allocator<T>().deallocate(p, n);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(tracking_allocator<T> const&, tracking_allocator<U> const&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(tracking_allocator<T> const&, tracking_allocator<U> const&) {
+  return false;
+}
+
+template <typename T, typename Growth>
+using tracked_vector = socow_vector<T, 4, socow_plain_refcount,
+                                    tracking_allocator<T>, Growth>;
+
+void report_heap(benchmark::State& state, size_t elements,
+                 size_t element_size) {
+  state.SetItemsProcessed(state.iterations() * elements);
+  state.counters["peak_bytes"] = static_cast<double>(heap_usage::peak_bytes);
+  state.counters["overhead"] = static_cast<double>(heap_usage::peak_bytes) /
+                               static_cast<double>(elements * element_size);
+  state.counters["allocs"] = benchmark::Counter(
+      static_cast<double>(heap_usage::allocations),
+      benchmark::Counter::kAvgIterations);
+}
+
+// Appends state.range(0) elements one by one: the growth policy decides how
+// often the vector reallocates and how much of the last buffer stays unused.
+template <typename T, typename Growth>
+void append(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0));
+  heap_usage::reset();
+  for (auto _ : state) {
+    tracked_vector<T, Growth> v;
+    for (size_t i = 0; i != n; ++i) {
+      v.push_back(T(i));
+    }
+    benchmark::DoNotOptimize(v.cdata());
+  }
+  report_heap(state, n, sizeof(T));
+}
+
+// Keeps many small vectors alive at once, as values of a map would be: the
+// first heap capacity dominates the footprint.
+template <typename T, typename Growth>
+void many_small(benchmark::State& state) {
+  size_t const vectors = 4096;
+  size_t n = static_cast<size_t>(state.range(0));
+  heap_usage::reset();
+  for (auto _ : state) {
+    std::unique_ptr<tracked_vector<T, Growth>[]> all(
+        new tracked_vector<T, Growth>[vectors]);
+    for (size_t i = 0; i != n; ++i) {
+      for (size_t j = 0; j != vectors; ++j) {
+        all[j].push_back(T(i));
+      }
+    }
+    benchmark::DoNotOptimize(all.get());
+  }
+  report_heap(state, n * vectors, sizeof(T));
+}
+
+using growth_2x = socow_growth_2x<>;
+using growth_1_5x = socow_growth_1_5x<>;
+using growth_1_5x_first_16 = socow_growth_1_5x<16>;
+using size_class_2x = socow_size_class_growth<socow_growth_2x<>>;
+using size_class_1_5x = socow_size_class_growth<socow_growth_1_5x<>>;
+
+} // namespace
+
+BENCHMARK_TEMPLATE(append, uint32_t, growth_2x)->Range(64, 1 << 20);
+BENCHMARK_TEMPLATE(append, uint32_t, growth_1_5x)->Range(64, 1 << 20);
+BENCHMARK_TEMPLATE(append, uint32_t, size_class_2x)->Range(64, 1 << 20);
+BENCHMARK_TEMPLATE(append, uint32_t, size_class_1_5x)->Range(64, 1 << 20);
+
+BENCHMARK_TEMPLATE(many_small, uint32_t, growth_2x)->DenseRange(5, 20, 5);
+BENCHMARK_TEMPLATE(many_small, uint32_t, growth_1_5x)->DenseRange(5, 20, 5);
+BENCHMARK_TEMPLATE(many_small, uint32_t, growth_1_5x_first_16)
+    ->DenseRange(5, 20, 5);
+BENCHMARK_TEMPLATE(many_small, uint32_t, size_class_1_5x)
+    ->DenseRange(5, 20, 5);
@@ -0,0 +1,61 @@
+#include <cstddef>
+#include <cstdint>
+
+#include <benchmark/benchmark.h>
+
+#include "socow-mmap.h"
+#include "socow-vector.h"
+
+// Vectors of a gigabyte: appending to them and scanning them, with buffers
+// from malloc against huge-page mappings grown with mremap.
+
+namespace {
+
+using heap = socow_vector<int64_t, 4>;
+using mapped = socow_vector<int64_t, 4, socow_plain_refcount,
+                            socow_mmap_allocator<int64_t>>;
+
+constexpr int64_t GIGABYTE = int64_t{1} << 30;
+
+template <typename Vector>
+void append(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0)) / sizeof(int64_t);
+  for (auto _ : state) {
+    Vector v;
+    for (size_t i = 0; i != n; ++i) {
+      v.push_back(static_cast<int64_t>(i));
+    }
+    benchmark::DoNotOptimize(v.cdata());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+template <typename Vector>
+void scan(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0)) / sizeof(int64_t);
+  Vector v;
+  for (size_t i = 0; i != n; ++i) {
+    v.push_back(static_cast<int64_t>(i));
+  }
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (int64_t value : v.reads()) {
+      sum += value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(append, heap)
+    ->Arg(GIGABYTE)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_TEMPLATE(append, mapped)
+    ->Arg(GIGABYTE)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_TEMPLATE(scan, heap)->Arg(GIGABYTE)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(scan, mapped)->Arg(GIGABYTE)->Unit(benchmark::kMillisecond);
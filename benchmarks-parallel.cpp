@@ -0,0 +1,53 @@
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+#include <benchmark/benchmark.h>
+
+#include "socow-thread-pool.h"
+#include "socow-vector.h"
+
+// Unsharing a large buffer on a socow_thread_pool of 1 to 8 threads, for
+// elements copied with memcpy and for elements copied one by one.
+
+namespace {
+
+template <typename T>
+T make(size_t i) {
+  if constexpr (std::is_same_v<T, std::string>) {
+    return std::string(32, static_cast<char>('a' + i % 26));
+  } else {
+    return static_cast<T>(i);
+  }
+}
+
+template <typename T>
+void parallel_unshare(benchmark::State& state) {
+  using vector = socow_vector<T, 4, socow_atomic_refcount>;
+  size_t const n = (size_t{64} << 20) / sizeof(T);
+  socow_thread_pool pool(static_cast<size_t>(state.range(0)));
+  socow_parallel::set(&pool, 1 << 20);
+  vector source;
+  source.reserve(n);
+  for (size_t i = 0; i != n; ++i) {
+    source.push_back(make<T>(i));
+  }
+  for (auto _ : state) {
+    vector copy = source;
+    copy[0] = source.cdata()[1];
+    benchmark::DoNotOptimize(copy.cdata());
+  }
+  state.SetBytesProcessed(state.iterations() * sizeof(T) * source.size());
+  socow_parallel::set(nullptr);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(parallel_unshare, long)
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(parallel_unshare, std::string)
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->UseRealTime();
@@ -0,0 +1,59 @@
+#include <cstddef>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "socow-reclaimer.h"
+#include "socow-vector.h"
+
+// The time the last owner of a buffer of strings takes to drop it, with the
+// buffer destroyed inline and handed to a socow_background_reclaimer.
+
+namespace {
+
+using vector = socow_vector<std::string, 4, socow_atomic_refcount>;
+
+vector strings(size_t n) {
+  vector v;
+  v.reserve(n);
+  for (size_t i = 0; i != n; ++i) {
+    v.push_back(std::string(32, static_cast<char>('a' + i % 26)));
+  }
+  return v;
+}
+
+void drop_inline(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    vector v = strings(n);
+    state.ResumeTiming();
+    v = vector();
+  }
+}
+
+void drop_deferred(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0));
+  socow_background_reclaimer reclaimer;
+  socow_deferred::set(&reclaimer);
+  for (auto _ : state) {
+    state.PauseTiming();
+    vector v = strings(n);
+    reclaimer.drain();
+    state.ResumeTiming();
+    v = vector();
+  }
+  socow_deferred::set(nullptr);
+  state.counters["peak_depth"] = static_cast<double>(reclaimer.peak_depth());
+}
+
+} // namespace
+
+BENCHMARK(drop_inline)
+    ->Range(1 << 14, 1 << 20)
+    ->Iterations(20)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(drop_deferred)
+    ->Range(1 << 14, 1 << 20)
+    ->Iterations(20)
+    ->Unit(benchmark::kMicrosecond);
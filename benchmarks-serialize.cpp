@@ -0,0 +1,66 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "socow-serialize.h"
+#include "socow-vector.h"
+
+// Serialization throughput: copying a vector into a byte buffer, as done
+// before socow-serialize.h, against the zero-copy view and deserialize.
+
+namespace {
+
+using vector = socow_vector<int64_t, 4>;
+
+vector filled(size_t n) {
+  vector v;
+  v.reserve(n);
+  for (size_t i = 0; i != n; ++i) {
+    v.push_back(static_cast<int64_t>(i));
+  }
+  return v;
+}
+
+void serialize_by_copy(benchmark::State& state) {
+  vector const v = filled(static_cast<size_t>(state.range(0)));
+  for (auto _ : state) {
+    std::vector<char> bytes(sizeof(socow_wire_header) +
+                            sizeof(int64_t) * v.size());
+    std::memcpy(bytes.data() + sizeof(socow_wire_header), v.cdata(),
+                sizeof(int64_t) * v.size());
+    benchmark::DoNotOptimize(bytes.data());
+  }
+  state.SetBytesProcessed(state.iterations() * sizeof(int64_t) * v.size());
+}
+
+void serialize_view(benchmark::State& state) {
+  vector const v = filled(static_cast<size_t>(state.range(0)));
+  for (auto _ : state) {
+    auto serialized = socow_serialize(v);
+    benchmark::DoNotOptimize(serialized.payload());
+  }
+  state.SetBytesProcessed(state.iterations() * sizeof(int64_t) * v.size());
+}
+
+void deserialize(benchmark::State& state) {
+  vector const v = filled(static_cast<size_t>(state.range(0)));
+  auto serialized = socow_serialize(v);
+  std::vector<char> bytes(serialized.size());
+  std::memcpy(bytes.data(), &serialized.header(), sizeof(socow_wire_header));
+  std::memcpy(bytes.data() + sizeof(socow_wire_header), serialized.payload(),
+              sizeof(int64_t) * v.size());
+  for (auto _ : state) {
+    vector result = socow_deserialize<vector>(bytes.data(), bytes.size());
+    benchmark::DoNotOptimize(result.cdata());
+  }
+  state.SetBytesProcessed(state.iterations() * sizeof(int64_t) * v.size());
+}
+
+} // namespace
+
+BENCHMARK(serialize_by_copy)->Range(4, 1 << 20);
+BENCHMARK(serialize_view)->Range(4, 1 << 20);
+BENCHMARK(deserialize)->Range(4, 1 << 20);
@@ -0,0 +1,205 @@
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#ifdef SOCOW_BENCHMARK_BOOST
+#include <boost/container/small_vector.hpp>
+#endif
+#ifdef SOCOW_BENCHMARK_ABSL
+#include <absl/container/inlined_vector.h>
+#endif
+
+#include "socow-vector.h"
+
+// Compares socow_vector with std::vector and, when they are found at build
+// time, with boost::container::small_vector and absl::InlinedVector. Every
+// benchmark is named operation/container<element type, small size>/sizes.
+// Run the `benchmarks_json` target to record the results as JSON.
+
+namespace {
+
+struct pod64 {
+  uint64_t words[8];
+};
+
+template <typename T>
+T make(size_t i);
+
+template <>
+int make<int>(size_t i) {
+  return static_cast<int>(i);
+}
+
+// Long enough not to fit in the small string buffer.
+template <>
+std::string make<std::string>(size_t i) {
+  return "a string that lives on the heap #" + std::to_string(i);
+}
+
+template <>
+pod64 make<pod64>(size_t i) {
+  return {{i, i, i, i, i, i, i, i}};
+}
+
+size_t weight(int value) {
+  return static_cast<size_t>(value);
+}
+
+size_t weight(std::string const& value) {
+  return value.size();
+}
+
+size_t weight(pod64 const& value) {
+  return value.words[0];
+}
+
+template <typename Container>
+Container filled(size_t n) {
+  using T = typename Container::value_type;
+  Container c;
+  for (size_t i = 0; i != n; ++i) {
+    c.push_back(make<T>(i));
+  }
+  return c;
+}
+
+template <typename Container>
+void push_back(benchmark::State& state) {
+  using T = typename Container::value_type;
+  size_t n = static_cast<size_t>(state.range(0));
+  std::vector<T> values;
+  for (size_t i = 0; i != n; ++i) {
+    values.push_back(make<T>(i));
+  }
+  for (auto _ : state) {
+    Container c;
+    for (T const& value : values) {
+      c.push_back(value);
+    }
+    benchmark::DoNotOptimize(c.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <typename Container>
+void copy(benchmark::State& state) {
+  Container const source = filled<Container>(state.range(0));
+  for (auto _ : state) {
+    Container c(source);
+    benchmark::DoNotOptimize(&c);
+  }
+}
+
+// Copies and writes one element: the copy-on-write path of socow_vector.
+template <typename Container>
+void copy_then_mutate(benchmark::State& state) {
+  using T = typename Container::value_type;
+  Container const source = filled<Container>(state.range(0));
+  T const value = make<T>(42);
+  for (auto _ : state) {
+    Container c(source);
+    c[0] = value;
+    benchmark::DoNotOptimize(&c);
+  }
+}
+
+template <typename Container>
+void swap(benchmark::State& state) {
+  Container a = filled<Container>(state.range(0));
+  Container b = filled<Container>(state.range(1));
+  for (auto _ : state) {
+    a.swap(b);
+    benchmark::DoNotOptimize(&a);
+    benchmark::DoNotOptimize(&b);
+  }
+}
+
+template <typename Container>
+void insert_erase_middle(benchmark::State& state) {
+  using T = typename Container::value_type;
+  size_t n = static_cast<size_t>(state.range(0));
+  Container c = filled<Container>(n);
+  T const value = make<T>(42);
+  for (auto _ : state) {
+    c.insert(c.begin() + n / 2, value);
+    c.erase(c.begin() + n / 2);
+    benchmark::DoNotOptimize(c.data());
+  }
+}
+
+template <typename Container>
+void iterate(benchmark::State& state) {
+  size_t n = static_cast<size_t>(state.range(0));
+  Container const c = filled<Container>(n);
+  for (auto _ : state) {
+    size_t sum = 0;
+    for (auto const& value : c) {
+      sum += weight(value);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Sizes below, between and far above the small sizes swept.
+constexpr int64_t SIZES[] = {3, 12, 1000};
+
+template <typename Container>
+void register_container(std::string const& name) {
+  auto add = [&](char const* operation, void (*run)(benchmark::State&)) {
+    return benchmark::RegisterBenchmark(
+        (std::string(operation) + "/" + name).c_str(), run);
+  };
+  for (int64_t n : SIZES) {
+    add("push_back", push_back<Container>)->Arg(n);
+    add("copy", copy<Container>)->Arg(n);
+    add("copy_then_mutate", copy_then_mutate<Container>)->Arg(n);
+    add("insert_erase_middle", insert_erase_middle<Container>)->Arg(n);
+    add("iterate", iterate<Container>)->Arg(n);
+  }
+  auto swaps = add("swap", swap<Container>);
+  swaps->Args({SIZES[0], SIZES[0]});
+  swaps->Args({SIZES[0], SIZES[2]});
+  swaps->Args({SIZES[2], SIZES[2]});
+}
+
+template <typename T, size_t SMALL_SIZE>
+void register_small(std::string const& type) {
+  std::string params = "<" + type + "," + std::to_string(SMALL_SIZE) + ">";
+  register_container<socow_vector<T, SMALL_SIZE>>("socow_vector" + params);
+#ifdef SOCOW_BENCHMARK_BOOST
+  register_container<boost::container::small_vector<T, SMALL_SIZE>>(
+      "boost_small_vector" + params);
+#endif
+#ifdef SOCOW_BENCHMARK_ABSL
+  register_container<absl::InlinedVector<T, SMALL_SIZE>>(
+      "absl_inlined_vector" + params);
+#endif
+}
+
+template <typename T>
+void register_type(std::string const& type) {
+  register_container<std::vector<T>>("std_vector<" + type + ">");
+  register_small<T, 4>(type);
+  register_small<T, 16>(type);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  register_type<int>("int");
+  register_type<std::string>("string");
+  register_type<pod64>("pod64");
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -3,3 +3,4 @@ set -euo pipefail
 IFS=$' \t\n'
 
 cmake-build-$1/tests
+cmake-build-$1/tests-stats
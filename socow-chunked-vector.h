@@ -0,0 +1,289 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "socow-vector.h"
+
+// The largest power of two number of elements that fits in 4 KiB.
+template <typename T>
+constexpr size_t socow_default_chunk_size() {
+  size_t size = 1;
+  while (2 * size * sizeof(T) <= 4096) {
+    size *= 2;
+  }
+  return size;
+}
+
+// A vector for large arrays that are copied often and then written to
+// sparsely. The elements are kept in chunks of CHUNK_SIZE, each a
+// copy-on-write socow_vector, listed by a copy-on-write table that is
+// itself a socow_vector of chunks. Copying the vector shares the table; the
+// first write after that copies the table, which takes a reference on every
+// chunk, and the one chunk it touches. A write thus costs O(size /
+// CHUNK_SIZE + CHUNK_SIZE) instead of O(size). Up to SMALL_CHUNKS chunks are
+// listed in the small storage of the table.
+//
+// Indexing costs a shift and a mask more than socow_vector; iteration only
+// looks up the next chunk once every CHUNK_SIZE elements. Reading through a
+// non-const vector never unshares: there are only const iterators, and
+// mutation goes through operator[], front(), back() and the modifiers.
+template <typename T, size_t CHUNK_SIZE = socow_default_chunk_size<T>(),
+          size_t SMALL_CHUNKS = 2, typename RefCount = socow_plain_refcount>
+struct socow_chunked_vector {
+  static_assert(CHUNK_SIZE != 0 && (CHUNK_SIZE & (CHUNK_SIZE - 1)) == 0,
+                "CHUNK_SIZE must be a power of two");
+
+  using value_type = T;
+
+  struct const_iterator;
+  using iterator = const_iterator;
+
+  socow_chunked_vector() = default;
+
+  socow_chunked_vector(socow_chunked_vector const&) = default;
+
+  // Leaves `other` empty.
+  socow_chunked_vector(socow_chunked_vector&& other) noexcept(
+      std::is_nothrow_move_constructible_v<table>)
+      : chunks_(std::move(other.chunks_)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  socow_chunked_vector& operator=(socow_chunked_vector const&) = default;
+
+  // Leaves `other` empty.
+  socow_chunked_vector& operator=(socow_chunked_vector&& other) noexcept(
+      std::is_nothrow_move_assignable_v<table>) {
+    chunks_ = std::move(other.chunks_);
+    size_ = std::exchange(other.size_, 0);
+    return *this;
+  }
+
+  T& operator[](size_t i) {
+    assert(size_ > i);
+    return chunks_[i / CHUNK_SIZE][i % CHUNK_SIZE];
+  }
+
+  T const& operator[](size_t i) const {
+    assert(size_ > i);
+    return chunks_.cdata()[i / CHUNK_SIZE].cdata()[i % CHUNK_SIZE];
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  T& front() {
+    assert(size_ > 0);
+    return (*this)[0];
+  }
+
+  T const& front() const {
+    assert(size_ > 0);
+    return (*this)[0];
+  }
+
+  T& back() {
+    assert(size_ > 0);
+    return (*this)[size_ - 1];
+  }
+
+  T const& back() const {
+    assert(size_ > 0);
+    return (*this)[size_ - 1];
+  }
+
+  void push_back(T const& e) {
+    emplace_back(e);
+  }
+
+  void push_back(T&& e) {
+    emplace_back(std::move(e));
+  }
+
+  // Elements never move once constructed, so `args` may refer to elements
+  // of this vector.
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (size_ % CHUNK_SIZE == 0) {
+      chunk fresh;
+      fresh.reserve(CHUNK_SIZE);
+      T& result = fresh.emplace_back(std::forward<Args>(args)...);
+      chunks_.push_back(std::move(fresh));
+      ++size_;
+      return result;
+    }
+    T& result = chunks_.back().emplace_back(std::forward<Args>(args)...);
+    ++size_;
+    return result;
+  }
+
+  void pop_back() {
+    assert(size_ > 0);
+    if ((size_ - 1) % CHUNK_SIZE == 0) {
+      chunks_.pop_back();
+    } else {
+      chunks_.back().pop_back();
+    }
+    --size_;
+  }
+
+  void clear() {
+    chunks_.clear();
+    size_ = 0;
+  }
+
+  void swap(socow_chunked_vector& other) {
+    chunks_.swap(other.chunks_);
+    std::swap(size_, other.size_);
+  }
+
+  const_iterator begin() const {
+    return const_iterator(&chunks_, 0);
+  }
+
+  const_iterator end() const {
+    return const_iterator(&chunks_, size_);
+  }
+
+  const_iterator cbegin() const {
+    return begin();
+  }
+
+  const_iterator cend() const {
+    return end();
+  }
+
+private:
+  using chunk = socow_vector<T, 0, RefCount>;
+  using table = socow_vector<chunk, SMALL_CHUNKS, RefCount>;
+
+public:
+  // Remembers the chunk it is in, so that stepping through the elements only
+  // looks a chunk up when it crosses into the next one.
+  struct const_iterator {
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T const*;
+    using reference = T const&;
+
+    const_iterator() = default;
+
+    T const& operator*() const {
+      return chunk_[index_ % CHUNK_SIZE];
+    }
+
+    T const* operator->() const {
+      return &**this;
+    }
+
+    T const& operator[](difference_type n) const {
+      return *(*this + n);
+    }
+
+    const_iterator& operator++() {
+      if (++index_ % CHUNK_SIZE == 0) {
+        locate();
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator result = *this;
+      ++*this;
+      return result;
+    }
+
+    const_iterator& operator--() {
+      if (index_-- % CHUNK_SIZE == 0) {
+        locate();
+      }
+      return *this;
+    }
+
+    const_iterator operator--(int) {
+      const_iterator result = *this;
+      --*this;
+      return result;
+    }
+
+    const_iterator& operator+=(difference_type n) {
+      index_ += n;
+      locate();
+      return *this;
+    }
+
+    const_iterator& operator-=(difference_type n) {
+      return *this += -n;
+    }
+
+    friend const_iterator operator+(const_iterator it, difference_type n) {
+      return it += n;
+    }
+
+    friend const_iterator operator+(difference_type n, const_iterator it) {
+      return it += n;
+    }
+
+    friend const_iterator operator-(const_iterator it, difference_type n) {
+      return it -= n;
+    }
+
+    friend difference_type operator-(const_iterator const& a,
+                                     const_iterator const& b) {
+      return static_cast<difference_type>(a.index_ - b.index_);
+    }
+
+    friend bool operator==(const_iterator const& a, const_iterator const& b) {
+      return a.index_ == b.index_;
+    }
+
+    friend bool operator!=(const_iterator const& a, const_iterator const& b) {
+      return a.index_ != b.index_;
+    }
+
+    friend bool operator<(const_iterator const& a, const_iterator const& b) {
+      return a.index_ < b.index_;
+    }
+
+    friend bool operator>(const_iterator const& a, const_iterator const& b) {
+      return b < a;
+    }
+
+    friend bool operator<=(const_iterator const& a, const_iterator const& b) {
+      return !(b < a);
+    }
+
+    friend bool operator>=(const_iterator const& a, const_iterator const& b) {
+      return !(a < b);
+    }
+
+  private:
+    friend struct socow_chunked_vector;
+
+    const_iterator(table const* chunks, size_t index)
+        : chunks_(chunks), index_(index) {
+      locate();
+    }
+
+    void locate() {
+      size_t c = index_ / CHUNK_SIZE;
+      chunk_ = c < chunks_->size() ? chunks_->cdata()[c].cdata() : nullptr;
+    }
+
+    table const* chunks_{nullptr};
+    size_t index_{0};
+    T const* chunk_{nullptr};
+  };
+
+private:
+  table chunks_;
+  size_t size_{0};
+};
@@ -0,0 +1,145 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include <sys/mman.h>
+
+#include "socow-vector.h"
+
+// An allocator for vectors that grow to hundreds of megabytes. Blocks of at
+// least THRESHOLD bytes are mapped straight from the system, aligned to and
+// rounded up to huge pages, and advised to be backed by transparent huge
+// pages, which cuts the TLB misses of scanning them. Growing such a block
+// remaps its pages with mremap instead of copying them; smaller blocks come
+// from malloc and grow with realloc. A vector of trivially relocatable
+// elements that owns its buffer alone grows through reallocate_at_least.
+template <typename T, size_t THRESHOLD = size_t{1} << 21>
+struct socow_mmap_allocator {
+  static_assert(alignof(T) <= alignof(std::max_align_t),
+                "over-aligned types are not supported");
+
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = socow_mmap_allocator<U, THRESHOLD>;
+  };
+
+  static constexpr size_t HUGE_PAGE = size_t{1} << 21;
+
+  socow_mmap_allocator() noexcept = default;
+
+  template <typename U>
+  socow_mmap_allocator(socow_mmap_allocator<U, THRESHOLD> const&) noexcept {}
+
+  T* allocate(size_t n) {
+    return allocate_at_least(n).ptr;
+  }
+
+  // Reports the rest of the last huge page of a mapped block as usable.
+  // Blocks from malloc report exactly `n`, so that deallocate can tell the
+  // two kinds apart by the count alone.
+  socow_allocation_result<T*> allocate_at_least(size_t n) {
+    if (n > std::numeric_limits<size_t>::max() / sizeof(T) - HUGE_PAGE) {
+      throw std::bad_alloc();
+    }
+    if (!mapped(n)) {
+      void* p = std::malloc(sizeof(T) * n);
+      if (p == nullptr) {
+        throw std::bad_alloc();
+      }
+      return {static_cast<T*>(p), n};
+    }
+    size_t bytes = mapping_size(n);
+    return {static_cast<T*>(map(bytes)), bytes / sizeof(T)};
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    if (mapped(n)) {
+      munmap(p, mapping_size(n));
+    } else {
+      std::free(p);
+    }
+  }
+
+  socow_allocation_result<T*> reallocate_at_least(T* p, size_t old_count,
+                                                  size_t new_count) {
+    if (new_count > std::numeric_limits<size_t>::max() / sizeof(T) -
+                        HUGE_PAGE) {
+      throw std::bad_alloc();
+    }
+#ifdef MREMAP_MAYMOVE
+    if (mapped(old_count) && mapped(new_count)) {
+      size_t bytes = mapping_size(new_count);
+      void* q = mremap(p, mapping_size(old_count), bytes, MREMAP_MAYMOVE);
+      if (q == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+      madvise(q, bytes, MADV_HUGEPAGE);
+      return {static_cast<T*>(q), bytes / sizeof(T)};
+    }
+#endif
+    if (!mapped(old_count) && !mapped(new_count)) {
+      void* q = std::realloc(p, sizeof(T) * new_count);
+      if (q == nullptr) {
+        throw std::bad_alloc();
+      }
+      return {static_cast<T*>(q), new_count};
+    }
+    socow_allocation_result<T*> result = allocate_at_least(new_count);
+    std::memcpy(static_cast<void*>(result.ptr), p,
+                sizeof(T) * std::min(old_count, new_count));
+    deallocate(p, old_count);
+    return result;
+  }
+
+private:
+  static bool mapped(size_t n) noexcept {
+    return sizeof(T) * n >= THRESHOLD;
+  }
+
+  static size_t mapping_size(size_t n) noexcept {
+    return (sizeof(T) * n + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+  }
+
+  // Maps a huge page more than needed and unmaps the ends around the first
+  // huge page boundary, so that the whole block can be backed by them.
+  static void* map(size_t bytes) {
+    size_t total = bytes + HUGE_PAGE;
+    void* p = mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    char* first = static_cast<char*>(p);
+    char* start = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(first) + HUGE_PAGE - 1) /
+        HUGE_PAGE * HUGE_PAGE);
+    if (start != first) {
+      munmap(first, start - first);
+    }
+    size_t tail = total - bytes - (start - first);
+    if (tail != 0) {
+      munmap(start + bytes, tail);
+    }
+    madvise(start, bytes, MADV_HUGEPAGE);
+    return start;
+  }
+};
+
+template <typename T, typename U, size_t THRESHOLD>
+bool operator==(socow_mmap_allocator<T, THRESHOLD> const&,
+                socow_mmap_allocator<U, THRESHOLD> const&) {
+  return true;
+}
+
+template <typename T, typename U, size_t THRESHOLD>
+bool operator!=(socow_mmap_allocator<T, THRESHOLD> const&,
+                socow_mmap_allocator<U, THRESHOLD> const&) {
+  return false;
+}
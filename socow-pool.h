@@ -0,0 +1,278 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+#include "socow-vector.h"
+
+struct socow_pool_stats {
+  size_t hits;         // allocations served from a cache
+  size_t misses;       // allocations that went to operator new
+  size_t bytes_cached; // free bytes held by the caches
+};
+
+// Caches freed heap blocks by power-of-two size class so that growing,
+// unsharing and dropping vectors stops going to the global allocator.
+// Every thread keeps a small magazine of free blocks per class; a full
+// magazine flushes half of itself to a global depot and an empty one refills
+// from it. Requests larger than the biggest class bypass the caches.
+struct socow_pool {
+  static constexpr size_t MIN_CLASS = 5;  // 32 bytes
+  static constexpr size_t MAX_CLASS = 20; // 1 MiB
+  static constexpr size_t CLASSES = MAX_CLASS - MIN_CLASS + 1;
+  static constexpr size_t MAGAZINE_SIZE = 16;
+
+  // Never destroyed, so that vectors with static or thread storage duration
+  // can free into it at exit.
+  static socow_pool& instance() {
+    static socow_pool& pool = *new socow_pool;
+    return pool;
+  }
+
+  socow_pool(socow_pool const&) = delete;
+  socow_pool& operator=(socow_pool const&) = delete;
+
+  // Returns a block of at least `bytes` bytes.
+  void* allocate(size_t bytes) {
+    size_t c = size_class(bytes);
+    if (c >= CLASSES) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return operator new(bytes);
+    }
+    cache* local_cache = local();
+    if (local_cache == nullptr) {
+      return take(c);
+    }
+    magazine& m = local_cache->magazines[c];
+    if (m.count == 0) {
+      refill(m, c);
+    }
+    if (m.count == 0) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return operator new(class_bytes(c));
+    }
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    bytes_cached_.fetch_sub(class_bytes(c), std::memory_order_relaxed);
+    return m.blocks[--m.count];
+  }
+
+  // The size of the block that allocate(bytes) returns.
+  static size_t block_size(size_t bytes) noexcept {
+    size_t c = size_class(bytes);
+    return c < CLASSES ? class_bytes(c) : bytes;
+  }
+
+  // `bytes` must be between the size the block was allocated with and its
+  // block_size.
+  void deallocate(void* p, size_t bytes) noexcept {
+    size_t c = size_class(bytes);
+    if (c >= CLASSES) {
+      operator delete(p);
+      return;
+    }
+    cache* local_cache = local();
+    if (local_cache == nullptr) {
+      give(p, c);
+      return;
+    }
+    magazine& m = local_cache->magazines[c];
+    if (m.count == MAGAZINE_SIZE) {
+      flush(m, c, MAGAZINE_SIZE / 2);
+    }
+    m.blocks[m.count++] = p;
+    bytes_cached_.fetch_add(class_bytes(c), std::memory_order_relaxed);
+  }
+
+  socow_pool_stats stats() const noexcept {
+    return {hits_.load(std::memory_order_relaxed),
+            misses_.load(std::memory_order_relaxed),
+            bytes_cached_.load(std::memory_order_relaxed)};
+  }
+
+  // Returns the blocks cached by the depot and by the calling thread to the
+  // global allocator. Magazines of other threads are left alone.
+  void trim() noexcept {
+    cache* local_cache = local();
+    for (size_t c = 0; c != CLASSES; ++c) {
+      if (local_cache != nullptr) {
+        flush(local_cache->magazines[c], c, local_cache->magazines[c].count);
+      }
+      free_block* head;
+      size_t count;
+      {
+        std::lock_guard<std::mutex> lock(depot_[c].mutex);
+        head = depot_[c].head;
+        count = depot_[c].count;
+        depot_[c].head = nullptr;
+        depot_[c].count = 0;
+      }
+      bytes_cached_.fetch_sub(count * class_bytes(c),
+                              std::memory_order_relaxed);
+      release(head);
+    }
+  }
+
+private:
+  socow_pool() = default;
+
+  struct free_block {
+    free_block* next;
+  };
+
+  struct magazine {
+    std::array<void*, MAGAZINE_SIZE> blocks;
+    size_t count{0};
+  };
+
+  struct cache {
+    ~cache() {
+      socow_pool& pool = instance();
+      for (size_t c = 0; c != CLASSES; ++c) {
+        pool.flush(magazines[c], c, magazines[c].count);
+      }
+      destroyed = true;
+    }
+
+    std::array<magazine, CLASSES> magazines;
+
+    // Trivially destructible, so that it can still be read once the cache
+    // of its thread is gone.
+    static inline thread_local bool destroyed = false;
+  };
+
+  struct depot {
+    std::mutex mutex;
+    free_block* head{nullptr};
+    size_t count{0};
+  };
+
+  // The cache of the calling thread, or nullptr once it has been destroyed
+  // at thread exit.
+  static cache* local() noexcept {
+    if (cache::destroyed) {
+      return nullptr;
+    }
+    thread_local cache local_cache;
+    return &local_cache;
+  }
+
+  // Takes a block of class `c` from the depot, bypassing the caches.
+  void* take(size_t c) {
+    free_block* block;
+    {
+      std::lock_guard<std::mutex> lock(depot_[c].mutex);
+      block = depot_[c].head;
+      if (block != nullptr) {
+        depot_[c].head = block->next;
+        --depot_[c].count;
+      }
+    }
+    if (block == nullptr) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return operator new(class_bytes(c));
+    }
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    bytes_cached_.fetch_sub(class_bytes(c), std::memory_order_relaxed);
+    return block;
+  }
+
+  // Returns a block of class `c` to the depot, bypassing the caches.
+  void give(void* p, size_t c) noexcept {
+    free_block* block = new (p) free_block;
+    {
+      std::lock_guard<std::mutex> lock(depot_[c].mutex);
+      block->next = depot_[c].head;
+      depot_[c].head = block;
+      ++depot_[c].count;
+    }
+    bytes_cached_.fetch_add(class_bytes(c), std::memory_order_relaxed);
+  }
+
+  // The index of the smallest class holding `bytes`, CLASSES if none does.
+  static size_t size_class(size_t bytes) noexcept {
+    size_t c = MIN_CLASS;
+    while (c <= MAX_CLASS && (size_t{1} << c) < bytes) {
+      ++c;
+    }
+    return c - MIN_CLASS;
+  }
+
+  static size_t class_bytes(size_t c) noexcept {
+    return size_t{1} << (c + MIN_CLASS);
+  }
+
+  void refill(magazine& m, size_t c) {
+    std::lock_guard<std::mutex> lock(depot_[c].mutex);
+    while (m.count != MAGAZINE_SIZE / 2 && depot_[c].head != nullptr) {
+      free_block* block = depot_[c].head;
+      depot_[c].head = block->next;
+      --depot_[c].count;
+      m.blocks[m.count++] = block;
+    }
+  }
+
+  void flush(magazine& m, size_t c, size_t count) noexcept {
+    std::lock_guard<std::mutex> lock(depot_[c].mutex);
+    for (; count != 0; --count) {
+      free_block* block = new (m.blocks[--m.count]) free_block;
+      block->next = depot_[c].head;
+      depot_[c].head = block;
+      ++depot_[c].count;
+    }
+  }
+
+  static void release(free_block* head) noexcept {
+    while (head != nullptr) {
+      free_block* next = head->next;
+      operator delete(head);
+      head = next;
+    }
+  }
+
+  std::array<depot, CLASSES> depot_;
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+  std::atomic<size_t> bytes_cached_{0};
+};
+
+// Allocates from socow_pool. Use it as the Allocator of a socow_vector.
+template <typename T>
+struct socow_pool_allocator {
+  static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                "over-aligned types are not supported by the pool");
+
+  using value_type = T;
+
+  socow_pool_allocator() noexcept = default;
+
+  template <typename U>
+  socow_pool_allocator(socow_pool_allocator<U> const&) noexcept {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(socow_pool::instance().allocate(sizeof(T) * n));
+  }
+
+  socow_allocation_result<T*> allocate_at_least(size_t n) {
+    size_t bytes = socow_pool::block_size(sizeof(T) * n);
+    return {static_cast<T*>(socow_pool::instance().allocate(bytes)),
+            bytes / sizeof(T)};
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    socow_pool::instance().deallocate(p, sizeof(T) * n);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(socow_pool_allocator<T> const&,
+                socow_pool_allocator<U> const&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(socow_pool_allocator<T> const&,
+                socow_pool_allocator<U> const&) {
+  return false;
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "socow-vector.h"
+
+// A thread that destroys and frees the buffers deferred to it, in the order
+// they come. Install it with socow_deferred::set(&reclaimer) so that dropping
+// the last reference to a big buffer returns without waiting for its
+// elements to be destroyed. Once `max_depth` buffers wait, further ones are
+// reclaimed by the thread that drops them, which bounds the memory held back.
+struct socow_background_reclaimer : socow_reclaimer {
+  explicit socow_background_reclaimer(size_t max_depth = 1024)
+      : max_depth_(max_depth), thread_([this] { loop(); }) {}
+
+  socow_background_reclaimer(socow_background_reclaimer const&) = delete;
+  socow_background_reclaimer&
+  operator=(socow_background_reclaimer const&) = delete;
+
+  // Reclaims what is still deferred before returning.
+  ~socow_background_reclaimer() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  bool defer(void (*reclaim)(void*, size_t) noexcept, void* buffer,
+             size_t size) noexcept override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_ || depth_ >= max_depth_) {
+        return false;
+      }
+      try {
+        queue_.push_back({reclaim, buffer, size});
+      } catch (...) {
+        return false;
+      }
+      ++depth_;
+      ++deferred_;
+      peak_depth_ = std::max(peak_depth_, depth_);
+    }
+    wake_.notify_one();
+    return true;
+  }
+
+  // Waits until every buffer deferred so far has been reclaimed.
+  void drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t target = deferred_;
+    drained_.wait(lock, [&] { return reclaimed_ >= target; });
+  }
+
+  // The number of buffers deferred and not reclaimed yet, including the one
+  // being reclaimed.
+  size_t depth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return depth_;
+  }
+
+  // The highest depth seen so far.
+  size_t peak_depth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_depth_;
+  }
+
+  // The number of buffers taken and reclaimed so far.
+  size_t deferred() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return deferred_;
+  }
+
+  size_t reclaimed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reclaimed_;
+  }
+
+private:
+  struct entry {
+    void (*reclaim)(void*, size_t) noexcept;
+    void* buffer;
+    size_t size;
+  };
+
+  void loop() noexcept {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      entry next = queue_.front();
+      queue_.pop_front();
+      lock.unlock();
+      next.reclaim(next.buffer, next.size);
+      lock.lock();
+      --depth_;
+      ++reclaimed_;
+      drained_.notify_all();
+    }
+  }
+
+  size_t const max_depth_;
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable drained_;
+  std::deque<entry> queue_;
+  size_t depth_ = 0;
+  size_t peak_depth_ = 0;
+  size_t deferred_ = 0;
+  size_t reclaimed_ = 0;
+  bool stop_ = false;
+  std::thread thread_;
+};
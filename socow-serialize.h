@@ -0,0 +1,159 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#if __has_include(<sys/uio.h>)
+#include <sys/uio.h>
+#define SOCOW_HAS_IOVEC 1
+#endif
+
+#include "socow-vector.h"
+
+// Binary form of vectors of trivially copyable elements: a socow_wire_header
+// followed by the raw bytes of the elements, in the byte order of the
+// machine that wrote them.
+
+struct socow_wire_header {
+  static constexpr uint32_t MAGIC = 0x31574f53; // "SOW1" little-endian
+  // How MAGIC reads on a machine of the other byte order.
+  static constexpr uint32_t SWAPPED_MAGIC = 0x534f5731;
+
+  uint64_t size;         // number of elements
+  uint32_t element_size; // sizeof of an element
+  uint32_t magic;
+};
+
+static_assert(sizeof(socow_wire_header) == 16);
+
+// Serializes a vector without copying its elements: it holds a pinned copy
+// of the vector, so the bytes stay valid while the vector itself changes.
+template <typename Vector>
+struct socow_serialized {
+  using value_type = typename Vector::value_type;
+
+  static_assert(std::is_trivially_copyable_v<value_type>,
+                "only vectors of trivially copyable elements are serialized");
+
+  explicit socow_serialized(Vector const& vector)
+      : header_{vector.size(), sizeof(value_type), socow_wire_header::MAGIC},
+        elements_(vector) {}
+
+  // The number of bytes of the serialized form.
+  size_t size() const noexcept {
+    return sizeof(header_) + sizeof(value_type) * elements_.size();
+  }
+
+  socow_wire_header const& header() const noexcept {
+    return header_;
+  }
+
+  void const* payload() const noexcept {
+    return elements_.data();
+  }
+
+#ifdef SOCOW_HAS_IOVEC
+  // The header and the elements, ready for writev.
+  std::array<iovec, 2> iovecs() const noexcept {
+    return {{{const_cast<socow_wire_header*>(&header_), sizeof(header_)},
+             {const_cast<value_type*>(elements_.data()),
+              sizeof(value_type) * elements_.size()}}};
+  }
+#endif
+
+  void write(std::ostream& out) const {
+    out.write(reinterpret_cast<char const*>(&header_), sizeof(header_));
+    out.write(static_cast<char const*>(payload()),
+              sizeof(value_type) * elements_.size());
+  }
+
+private:
+  socow_wire_header header_;
+  socow_pinned_span<Vector> elements_;
+};
+
+template <typename Vector>
+socow_serialized<Vector> socow_serialize(Vector const& vector) {
+  return socow_serialized<Vector>(vector);
+}
+
+// Checks a header read from the wire for a vector of `T`.
+template <typename T>
+void socow_check_header(socow_wire_header const& header) {
+  if (header.magic != socow_wire_header::MAGIC) {
+    throw std::invalid_argument(
+        header.magic == socow_wire_header::SWAPPED_MAGIC
+            ? "socow_deserialize: written with the other byte order"
+            : "socow_deserialize: not a serialized vector");
+  }
+  if (header.element_size != sizeof(T)) {
+    throw std::invalid_argument("socow_deserialize: element size mismatch");
+  }
+}
+
+// A vector of `size` elements left to be filled with their bytes. It takes
+// small storage or one heap buffer of the fitting capacity.
+template <typename Vector>
+Vector socow_uninitialized_vector(
+    uint64_t size, typename Vector::allocator_type const& alloc) {
+  if (size > std::numeric_limits<size_t>::max() /
+                 sizeof(typename Vector::value_type)) {
+    throw std::length_error("socow_deserialize: size is too large");
+  }
+  Vector result(alloc);
+  result.reserve(size);
+  result.resize_default_init(size);
+  return result;
+}
+
+// Reads a vector from `bytes` bytes at `data`, with a single copy of the
+// elements.
+template <typename Vector>
+Vector socow_deserialize(void const* data, size_t bytes,
+                         typename Vector::allocator_type const& alloc =
+                             typename Vector::allocator_type()) {
+  using T = typename Vector::value_type;
+  static_assert(std::is_trivially_copyable_v<T>);
+  socow_wire_header header;
+  if (bytes < sizeof(header)) {
+    throw std::invalid_argument("socow_deserialize: truncated header");
+  }
+  std::memcpy(&header, data, sizeof(header));
+  socow_check_header<T>(header);
+  if ((bytes - sizeof(header)) / sizeof(T) < header.size) {
+    throw std::invalid_argument("socow_deserialize: truncated elements");
+  }
+  Vector result = socow_uninitialized_vector<Vector>(header.size, alloc);
+  if (header.size != 0) {
+    std::memcpy(static_cast<void*>(result.data()),
+                static_cast<char const*>(data) + sizeof(header),
+                sizeof(T) * header.size);
+  }
+  return result;
+}
+
+// Reads a vector from `in`, straight into its storage.
+template <typename Vector>
+Vector socow_deserialize(std::istream& in,
+                         typename Vector::allocator_type const& alloc =
+                             typename Vector::allocator_type()) {
+  using T = typename Vector::value_type;
+  static_assert(std::is_trivially_copyable_v<T>);
+  socow_wire_header header;
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    throw std::invalid_argument("socow_deserialize: truncated header");
+  }
+  socow_check_header<T>(header);
+  Vector result = socow_uninitialized_vector<Vector>(header.size, alloc);
+  if (header.size != 0 &&
+      !in.read(reinterpret_cast<char*>(result.data()),
+               static_cast<std::streamsize>(sizeof(T) * header.size))) {
+    throw std::invalid_argument("socow_deserialize: truncated elements");
+  }
+  return result;
+}
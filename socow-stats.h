@@ -0,0 +1,140 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+
+// Runtime counters of socow_vector, kept when SOCOW_VECTOR_STATS is defined
+// before socow-vector.h is included; socow-vector.h includes this header
+// then. Every instantiation of socow_vector that records an event gets its
+// own counters in the global registry. Without the macro the recording
+// calls are empty and nothing here is compiled in.
+
+struct socow_counters {
+  explicit socow_counters(std::string name) : name(std::move(name)) {}
+
+  void record(socow_event event, size_t n) noexcept {
+    counters[static_cast<size_t>(event)].fetch_add(
+        n, std::memory_order_relaxed);
+  }
+
+  // Remembers the highest number of vectors seen sharing a buffer.
+  void record_links(size_t links) noexcept {
+    size_t peak = refcount_peak.load(std::memory_order_relaxed);
+    while (peak < links && !refcount_peak.compare_exchange_weak(
+                               peak, links, std::memory_order_relaxed)) {
+    }
+  }
+
+  size_t get(socow_event event) const noexcept {
+    return counters[static_cast<size_t>(event)].load(
+        std::memory_order_relaxed);
+  }
+
+  void reset() noexcept {
+    for (std::atomic<size_t>& counter : counters) {
+      counter.store(0, std::memory_order_relaxed);
+    }
+    refcount_peak.store(0, std::memory_order_relaxed);
+  }
+
+  static constexpr size_t EVENTS =
+      static_cast<size_t>(socow_event::big_to_small) + 1;
+  static constexpr char const* EVENT_NAMES[EVENTS] = {
+      "allocations",  "frees",        "unshares",    "unshare_bytes",
+      "move_bytes",   "small_to_big", "big_to_small"};
+
+  std::string const name;
+  std::atomic<size_t> counters[EVENTS] = {};
+  std::atomic<size_t> refcount_peak{0};
+};
+
+struct socow_stats_registry {
+  // Never destroyed, so that vectors with static or thread storage duration
+  // can record events at exit.
+  static socow_stats_registry& instance() {
+    static socow_stats_registry& registry = *new socow_stats_registry;
+    return registry;
+  }
+
+  // The counters of the instantiation whose type is `type`. They live as
+  // long as the program.
+  socow_counters& counters(std::type_info const& type) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.emplace_back(demangle(type.name()));
+    return entries_.back();
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (socow_counters& entry : entries_) {
+      entry.reset();
+    }
+  }
+
+  // One line per instantiation: its type, then name=value pairs.
+  void dump_text(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (socow_counters const& entry : entries_) {
+      out << entry.name << ':';
+      for (size_t i = 0; i != socow_counters::EVENTS; ++i) {
+        out << ' ' << socow_counters::EVENT_NAMES[i] << '='
+            << entry.counters[i].load(std::memory_order_relaxed);
+      }
+      out << " refcount_peak="
+          << entry.refcount_peak.load(std::memory_order_relaxed) << '\n';
+    }
+  }
+
+  // An array with an object per instantiation.
+  void dump_json(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << '[';
+    char const* separator = "";
+    for (socow_counters const& entry : entries_) {
+      out << separator << "{\"type\":\"";
+      for (char c : entry.name) {
+        if (c == '"' || c == '\\') {
+          out << '\\';
+        }
+        out << c;
+      }
+      out << '"';
+      for (size_t i = 0; i != socow_counters::EVENTS; ++i) {
+        out << ",\"" << socow_counters::EVENT_NAMES[i] << "\":"
+            << entry.counters[i].load(std::memory_order_relaxed);
+      }
+      out << ",\"refcount_peak\":"
+          << entry.refcount_peak.load(std::memory_order_relaxed) << '}';
+      separator = ",";
+    }
+    out << "]\n";
+  }
+
+private:
+  socow_stats_registry() = default;
+
+  static std::string demangle(char const* name) {
+#if __has_include(<cxxabi.h>)
+    int status = 0;
+    std::unique_ptr<char, void (*)(void*)> demangled(
+        abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free);
+    if (status == 0) {
+      return demangled.get();
+    }
+#endif
+    return name;
+  }
+
+  mutable std::mutex mutex_;
+  std::deque<socow_counters> entries_;
+};
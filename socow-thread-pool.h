@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "socow-vector.h"
+
+// A fixed set of worker threads running the chunks of one job at a time,
+// together with the thread that submits it. Install it with
+// socow_parallel::set(&pool) to copy and destroy the elements of large
+// buffers in parallel. A job submitted while another one runs, or from a
+// task of this pool, runs on the submitting thread alone.
+struct socow_thread_pool : socow_executor {
+  // `threads` counts the submitting thread.
+  explicit socow_thread_pool(
+      size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+    for (size_t i = 1; i < threads; ++i) {
+      workers_.emplace_back([this] { loop(); });
+    }
+  }
+
+  socow_thread_pool(socow_thread_pool const&) = delete;
+  socow_thread_pool& operator=(socow_thread_pool const&) = delete;
+
+  ~socow_thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  size_t concurrency() const noexcept override {
+    return workers_.size() + 1;
+  }
+
+  void run(size_t count,
+           std::function<void(size_t)> const& task) noexcept override {
+    std::unique_lock<std::mutex> busy(submit_mutex_, std::try_to_lock);
+    if (!busy.owns_lock() || in_worker_ || workers_.empty()) {
+      for (size_t i = 0; i != count; ++i) {
+        task(i);
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = &task;
+      count_ = count;
+      next_.store(0, std::memory_order_relaxed);
+      pending_ = count;
+      ++generation_;
+    }
+    wake_.notify_all();
+    work(task, count);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0 && active_ == 0; });
+    task_ = nullptr;
+  }
+
+private:
+  // Takes chunks of the current job until none is left.
+  void work(std::function<void(size_t)> const& task, size_t count) noexcept {
+    for (size_t i; (i = next_.fetch_add(1, std::memory_order_relaxed)) <
+                   count;) {
+      task(i);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0) {
+        done_.notify_all();
+      }
+    }
+  }
+
+  void loop() noexcept {
+    in_worker_ = true;
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+      if (task_ == nullptr) {
+        continue;
+      }
+      std::function<void(size_t)> const& task = *task_;
+      size_t count = count_;
+      ++active_;
+      lock.unlock();
+      work(task, count);
+      lock.lock();
+      if (--active_ == 0) {
+        done_.notify_all();
+      }
+    }
+  }
+
+  static inline thread_local bool in_worker_ = false;
+
+  std::vector<std::thread> workers_;
+  std::mutex submit_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::function<void(size_t)> const* task_ = nullptr;
+  size_t count_ = 0;
+  std::atomic<size_t> next_{0};
+  size_t pending_ = 0;
+  size_t active_ = 0;
+  size_t generation_ = 0;
+  bool stop_ = false;
+};
@@ -1,383 +1,2362 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#if __cplusplus > 201703L && __has_include(<compare>)
+#include <compare>
+#endif
+#if defined(__linux__) && __has_include(<malloc.h>)
+#include <malloc.h>
+#define SOCOW_HAS_MALLOC_USABLE_SIZE 1
+#endif
 
-template <typename T, size_t SMALL_SIZE>
-struct socow_vector {
+// Events counted by socow_vector when it is built with SOCOW_VECTOR_STATS
+// defined, see socow-stats.h.
+enum class socow_event {
+  allocation,    // a heap buffer was allocated
+  free,          // a heap buffer was freed
+  unshare,       // the elements of a shared buffer were copied
+  unshare_bytes, // bytes copied out of shared buffers
+  move_bytes,    // bytes moved from storage owned alone into a new buffer
+  small_to_big,  // the small storage spilled to the heap
+  big_to_small,  // shrink_to_fit moved the elements back to small storage
+};
+
+#ifdef SOCOW_VECTOR_STATS
+#include "socow-stats.h"
+#endif
+
+// Tells whether moving a T to another address can be done with memcpy,
+// without calling the move constructor and the destructor of the source.
+// Specialize it for types that are safe to relocate this way to make growing
+// a vector of them a single memcpy.
+template <typename T>
+struct socow_is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+// Tells whether distinct objects of T can be copied and destroyed at the
+// same time on different threads, that is whether they share no state
+// without synchronization. Only the elements of such types are copied and
+// destroyed through socow_parallel or handed to socow_deferred. Specialize
+// it for types that are safe this way.
+template <typename T>
+struct socow_is_thread_independent : std::is_trivially_copyable<T> {};
+
+template <typename Char, typename Traits>
+struct socow_is_thread_independent<
+    std::basic_string<Char, Traits, std::allocator<Char>>> : std::true_type {
+};
+
+// Tells whether every T compares equal to itself, so that arrays sharing
+// their elements can be taken as equal without reading them. Floating point
+// types are not, because of NaN; specialize it to false for other types
+// whose operator== is not reflexive.
+template <typename T>
+struct socow_has_reflexive_equality
+    : std::negation<std::is_floating_point<T>> {};
+
+// Runs the chunks of large element copies and destructions, e.g. a thread
+// pool such as socow_thread_pool. run() calls task(0), ..., task(count - 1),
+// possibly on other threads and the calling one, and returns once all of
+// them have finished; the tasks do not throw.
+struct socow_executor {
+  virtual ~socow_executor() = default;
+
+  // How many chunks to split work into.
+  virtual size_t concurrency() const noexcept = 0;
+
+  virtual void run(size_t count,
+                   std::function<void(size_t)> const& task) noexcept = 0;
+};
+
+// The executor through which every socow_vector copies and destroys
+// elements that socow_is_thread_independent allows, in buffers of at least
+// `threshold` bytes. There is none by default, and the work is done on the
+// calling thread.
+struct socow_parallel {
+  static constexpr size_t DEFAULT_THRESHOLD = size_t{16} << 20;
+
+  // The executor must outlive its use; pass nullptr to stop using it.
+  static void set(socow_executor* executor,
+                  size_t threshold = DEFAULT_THRESHOLD) noexcept {
+    threshold_().store(threshold, std::memory_order_relaxed);
+    executor_().store(executor, std::memory_order_release);
+  }
+
+  // The executor to use for `bytes` bytes of elements, if any.
+  static socow_executor* executor_for(size_t bytes) noexcept {
+    if (bytes < threshold_().load(std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return executor_().load(std::memory_order_acquire);
+  }
+
+private:
+  static std::atomic<socow_executor*>& executor_() noexcept {
+    static std::atomic<socow_executor*> executor{nullptr};
+    return executor;
+  }
+
+  static std::atomic<size_t>& threshold_() noexcept {
+    static std::atomic<size_t> threshold{DEFAULT_THRESHOLD};
+    return threshold;
+  }
+};
+
+// Takes heap buffers whose last reference was dropped, to destroy their
+// elements and free them later, off the thread that dropped them, e.g.
+// socow_background_reclaimer. defer() either takes the buffer, to call
+// reclaim(buffer, size) exactly once, or returns false and leaves it to the
+// caller.
+struct socow_reclaimer {
+  virtual ~socow_reclaimer() = default;
+
+  virtual bool defer(void (*reclaim)(void*, size_t) noexcept, void* buffer,
+                     size_t size) noexcept = 0;
+};
+
+// The reclaimer to which every socow_vector hands the buffers of at least
+// `threshold` bytes of capacity when it drops their last reference. There is
+// none by default. The elements are then destroyed and the memory freed on
+// another thread, so only vectors of elements that socow_is_thread_independent
+// allows, with allocators that are always equal, defer their buffers.
+struct socow_deferred {
+  static constexpr size_t DEFAULT_THRESHOLD = size_t{1} << 20;
+
+  // The reclaimer must outlive its use; pass nullptr to stop using it.
+  static void set(socow_reclaimer* reclaimer,
+                  size_t threshold = DEFAULT_THRESHOLD) noexcept {
+    threshold_().store(threshold, std::memory_order_relaxed);
+    reclaimer_().store(reclaimer, std::memory_order_release);
+  }
+
+  // The reclaimer of a buffer of `bytes` bytes of capacity, if any.
+  static socow_reclaimer* reclaimer_for(size_t bytes) noexcept {
+    if (bytes < threshold_().load(std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return reclaimer_().load(std::memory_order_acquire);
+  }
+
+private:
+  static std::atomic<socow_reclaimer*>& reclaimer_() noexcept {
+    static std::atomic<socow_reclaimer*> reclaimer{nullptr};
+    return reclaimer;
+  }
+
+  static std::atomic<size_t>& threshold_() noexcept {
+    static std::atomic<size_t> threshold{DEFAULT_THRESHOLD};
+    return threshold;
+  }
+};
+
+// Reference counting policies for the heap buffer shared by copies of a
+// vector. `counter` is stored in the buffer and constructed from 1 by the
+// owner that allocates it. The capacity is stored next to it as `size_type`.
+// The 32-bit variants halve that header for vectors of small buffers; a
+// buffer then holds at most 2^32 - 1 elements and as many copies.
+
+// Not synchronized: copies sharing a buffer must be used from one thread.
+template <typename Size>
+struct socow_basic_plain_refcount {
+  using counter = Size;
+  using size_type = Size;
+
+  // Whether copies may share a buffer across threads.
+  static constexpr bool THREAD_SAFE = false;
+
+  static void acquire(counter& links) noexcept {
+    ++links;
+  }
+
+  // Returns true if the last reference was dropped.
+  static bool release(counter& links) noexcept {
+    return --links == 0;
+  }
+
+  static bool unique(counter const& links) noexcept {
+    return links == 1;
+  }
+
+  static size_t count(counter const& links) noexcept {
+    return links;
+  }
+};
+
+// Copies sharing a buffer may be used and destroyed from different threads.
+// A sole owner only pays for an acquire load to learn that it may write:
+// it synchronizes with the acq_rel decrement by which the other owners gave
+// the buffer up, so their reads of it happen before our writes.
+template <typename Size>
+struct socow_basic_atomic_refcount {
+  using counter = std::atomic<Size>;
+  using size_type = Size;
+
+  static constexpr bool THREAD_SAFE = true;
+
+  static void acquire(counter& links) noexcept {
+    links.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static bool release(counter& links) noexcept {
+    return links.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+
+  static bool unique(counter const& links) noexcept {
+    return links.load(std::memory_order_acquire) == 1;
+  }
+
+  static size_t count(counter const& links) noexcept {
+    return links.load(std::memory_order_relaxed);
+  }
+};
+
+using socow_plain_refcount = socow_basic_plain_refcount<size_t>;
+using socow_plain_refcount32 = socow_basic_plain_refcount<uint32_t>;
+using socow_atomic_refcount = socow_basic_atomic_refcount<size_t>;
+using socow_atomic_refcount32 = socow_basic_atomic_refcount<uint32_t>;
+
+// Values derived from the elements of a heap buffer, e.g. a hash, kept in
+// its header by socow_memoized for socow_vector::memo(). Any vector or
+// thread reading the buffer may add a value; only its sole owner forgets
+// them, before writing to the elements.
+struct socow_memo {
+  socow_memo() noexcept : head_(nullptr) {}
+
+  socow_memo(socow_memo const&) = delete;
+  socow_memo& operator=(socow_memo const&) = delete;
+
+  ~socow_memo() {
+    forget();
+  }
+
+  // The value stored under `key`, or `compute()` stored under it. Readers
+  // racing on the same key may both compute it; either value is kept.
+  template <typename Compute>
+  size_t get(void const* key, Compute&& compute) {
+    for (node* n = head_.load(std::memory_order_acquire); n != nullptr;
+         n = n->next) {
+      if (n->key == key) {
+        return n->value;
+      }
+    }
+    size_t value = compute();
+    node* fresh = new (std::nothrow)
+        node{key, value, head_.load(std::memory_order_relaxed)};
+    if (fresh != nullptr) {
+      while (!head_.compare_exchange_weak(fresh->next, fresh,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+      }
+    }
+    return value;
+  }
+
+  void forget() noexcept {
+    node* n = head_.load(std::memory_order_relaxed);
+    if (n != nullptr) {
+      head_.store(nullptr, std::memory_order_relaxed);
+      while (n != nullptr) {
+        node* next = n->next;
+        delete n;
+        n = next;
+      }
+    }
+  }
+
+private:
+  struct node {
+    void const* key;
+    size_t value;
+    node* next;
+  };
+
+  std::atomic<node*> head_;
+};
+
+// Wraps a reference counting policy to keep a socow_memo next to the counter
+// in every buffer header, which costs a pointer per buffer. Vectors using it
+// share the values socow_vector::memo() and std::hash derive among all the
+// copies of a buffer; with other policies they compute them every time.
+template <typename RefCount>
+struct socow_memoized : RefCount {
+  struct counter {
+    counter(typename RefCount::size_type links) noexcept : links(links) {}
+
+    typename RefCount::counter links;
+    socow_memo memo;
+  };
+
+  static void acquire(counter& c) noexcept {
+    RefCount::acquire(c.links);
+  }
+
+  static bool release(counter& c) noexcept {
+    return RefCount::release(c.links);
+  }
+
+  static bool unique(counter const& c) noexcept {
+    return RefCount::unique(c.links);
+  }
+
+  static size_t count(counter const& c) noexcept {
+    return RefCount::count(c.links);
+  }
+
+  static socow_memo& memo(counter& c) noexcept {
+    return c.memo;
+  }
+};
+
+template <typename RefCount, typename = void>
+struct socow_has_memo : std::false_type {};
+
+template <typename RefCount>
+struct socow_has_memo<
+    RefCount, std::void_t<decltype(RefCount::memo(
+                  std::declval<typename RefCount::counter&>()))>>
+    : std::true_type {};
+
+// Growth policies pick the capacity of a new heap buffer:
+//   static size_t grow(size_t capacity, size_t required, bool spill,
+//                      size_t header_size, size_t element_size);
+//   static size_t fit(size_t required, size_t header_size,
+//                     size_t element_size);
+// `grow` is called when an insertion needs room for `required` elements and
+// the current `capacity` is too small or shared; `spill` tells that it is the
+// small storage that overflows. `fit` is called by reserve. Both return at
+// least `required`. A buffer takes `header_size` bytes plus `element_size`
+// bytes per element.
+
+// Multiplies the capacity by NUM / DEN. The first heap buffer gets FIRST
+// elements, or twice the small storage if FIRST is 0.
+template <size_t NUM, size_t DEN, size_t FIRST = 0>
+struct socow_factor_growth {
+  static_assert(NUM > DEN, "the capacity must grow");
+
+  static size_t grow(size_t capacity, size_t required, bool spill, size_t,
+                     size_t) noexcept {
+    size_t next;
+    if (spill) {
+      next = FIRST != 0 ? FIRST : 2 * capacity;
+    } else {
+      next = capacity / DEN * NUM + capacity % DEN * NUM / DEN;
+    }
+    return std::max(next, required);
+  }
+
+  static size_t fit(size_t required, size_t, size_t) noexcept {
+    return required;
+  }
+};
+
+template <size_t FIRST = 0>
+using socow_growth_2x = socow_factor_growth<2, 1, FIRST>;
+
+// Wastes at most a third of the buffer instead of a half, at the price of
+// more reallocations while appending.
+template <size_t FIRST = 0>
+using socow_growth_1_5x = socow_factor_growth<3, 2, FIRST>;
+
+// Rounds the capacities chosen by Growth up so that whole buffers fill the
+// size classes of a malloc-like allocator: STEPS classes per power of two,
+// none smaller than MIN_BYTES. Use STEPS = 1 with socow_pool_allocator.
+template <typename Growth = socow_growth_2x<>, size_t STEPS = 4,
+          size_t MIN_BYTES = 16>
+struct socow_size_class_growth {
+  static_assert(STEPS != 0 && (STEPS & (STEPS - 1)) == 0,
+                "STEPS must be a power of two");
+
+  static size_t grow(size_t capacity, size_t required, bool spill,
+                     size_t header_size, size_t element_size) noexcept {
+    return round(Growth::grow(capacity, required, spill, header_size,
+                              element_size),
+                 header_size, element_size);
+  }
+
+  static size_t fit(size_t required, size_t header_size,
+                    size_t element_size) noexcept {
+    return round(Growth::fit(required, header_size, element_size),
+                 header_size, element_size);
+  }
+
+private:
+  static size_t round(size_t capacity, size_t header_size,
+                      size_t element_size) noexcept {
+    size_t bytes = header_size + capacity * element_size;
+    size_t step = MIN_BYTES;
+    while (step * STEPS * 2 < bytes) {
+      step *= 2;
+    }
+    bytes = (bytes + step - 1) / step * step;
+    return (bytes - header_size) / element_size;
+  }
+};
+
+// Lets range members take part in overload resolution only for iterators.
+template <typename It>
+using socow_iterator_category =
+    typename std::iterator_traits<It>::iterator_category;
+
+// What allocate_at_least returns: the memory and the number of objects that
+// fit in it, at least as many as were asked for. An allocator may provide
+//   socow_allocation_result<T*> allocate_at_least(size_t n);
+// for the vector to use the whole size class it is handed. deallocate is then
+// called with a count between the one asked for and the one returned.
+template <typename Pointer>
+struct socow_allocation_result {
+  Pointer ptr;
+  size_t count;
+};
+
+template <typename Allocator, typename = void>
+struct socow_has_allocate_at_least : std::false_type {};
+
+template <typename Allocator>
+struct socow_has_allocate_at_least<
+    Allocator, std::void_t<decltype(std::declval<Allocator&>()
+                                        .allocate_at_least(size_t{}))>>
+    : std::true_type {};
+
+// An allocator may also provide
+//   socow_allocation_result<T*> allocate_zeroed_at_least(size_t n);
+// handing out zero-filled memory, which the vector uses to value-initialize
+// large arrays of arithmetic elements without writing to them.
+template <typename Allocator, typename = void>
+struct socow_has_allocate_zeroed_at_least : std::false_type {};
+
+template <typename Allocator>
+struct socow_has_allocate_zeroed_at_least<
+    Allocator, std::void_t<decltype(std::declval<Allocator&>()
+                                        .allocate_zeroed_at_least(size_t{}))>>
+    : std::true_type {};
+
+// An allocator may also provide
+//   socow_allocation_result<T*> reallocate_at_least(T* p, size_t old_count,
+//                                                    size_t new_count);
+// moving the block of `old_count` objects at `p` to a block of at least
+// `new_count` objects that starts with its bytes, e.g. with realloc or
+// mremap. The vector resizes a buffer it owns alone with it when the
+// elements and the allocator are trivially relocatable. If it throws, the
+// old block must be left as it was.
+template <typename Allocator, typename = void>
+struct socow_has_reallocate_at_least : std::false_type {};
+
+template <typename Allocator>
+struct socow_has_reallocate_at_least<
+    Allocator,
+    std::void_t<decltype(std::declval<Allocator&>().reallocate_at_least(
+        std::declval<typename Allocator::value_type*>(), size_t{}, size_t{}))>>
+    : std::true_type {};
+
+// The default allocator, like std::allocator. It is declared outside of
+// namespace std so that vectors using it do not bring std into
+// argument-dependent lookup. Where malloc_usable_size is available it
+// allocates with malloc, so that it can report the real size of a block.
+template <typename T>
+struct socow_allocator {
+  using value_type = T;
+
+  socow_allocator() noexcept = default;
+
+  template <typename U>
+  socow_allocator(socow_allocator<U> const&) noexcept {}
+
+  T* allocate(size_t n) {
+    return allocate_at_least(n).ptr;
+  }
+
+  socow_allocation_result<T*> allocate_at_least(size_t n) {
+    if constexpr (OVER_ALIGNED) {
+      return {static_cast<T*>(operator new(sizeof(T) * n,
+                                           std::align_val_t(alignof(T)))),
+              n};
+    } else {
+#ifdef SOCOW_HAS_MALLOC_USABLE_SIZE
+      void* p = std::malloc(sizeof(T) * n);
+      if (p == nullptr) {
+        throw std::bad_alloc();
+      }
+      return {static_cast<T*>(p), malloc_usable_size(p) / sizeof(T)};
+#else
+      return {static_cast<T*>(operator new(sizeof(T) * n)), n};
+#endif
+    }
+  }
+
+  // calloc takes large blocks straight from fresh pages of the system, which
+  // are zero already and cost nothing until they are touched.
+  socow_allocation_result<T*> allocate_zeroed_at_least(size_t n) {
+#ifdef SOCOW_HAS_MALLOC_USABLE_SIZE
+    if constexpr (!OVER_ALIGNED) {
+      void* p = std::calloc(n, sizeof(T));
+      if (p == nullptr) {
+        throw std::bad_alloc();
+      }
+      return {static_cast<T*>(p), malloc_usable_size(p) / sizeof(T)};
+    }
+#endif
+    socow_allocation_result<T*> result = allocate_at_least(n);
+    std::memset(static_cast<void*>(result.ptr), 0, sizeof(T) * result.count);
+    return result;
+  }
+
+  void deallocate(T* p, size_t) noexcept {
+    if constexpr (OVER_ALIGNED) {
+      operator delete(p, std::align_val_t(alignof(T)));
+    } else {
+#ifdef SOCOW_HAS_MALLOC_USABLE_SIZE
+      std::free(p);
+#else
+      operator delete(p);
+#endif
+    }
+  }
+
+private:
+  static constexpr bool OVER_ALIGNED =
+      alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+};
+
+template <typename T, typename U>
+bool operator==(socow_allocator<T> const&, socow_allocator<U> const&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(socow_allocator<T> const&, socow_allocator<U> const&) {
+  return false;
+}
+
+// Compares two arrays of `n` elements. Arrays at the same address are equal
+// without looking at them if socow_has_reflexive_equality holds. Integers
+// and pointers are equal exactly when their bytes are, so they are compared
+// with memcmp.
+template <typename T>
+bool socow_equal(T const* a, T const* b, size_t n) {
+  if (n == 0) {
+    return true;
+  }
+  if constexpr (socow_has_reflexive_equality<T>::value) {
+    if (a == b) {
+      return true;
+    }
+  }
+  if constexpr (std::is_integral_v<T> || std::is_pointer_v<T>) {
+    return std::memcmp(a, b, sizeof(T) * n) == 0;
+  } else {
+    return std::equal(a, a + n, b);
+  }
+}
+
+// A read-only view of contiguous elements. Taking one from a vector never
+// unshares it, unlike the non-const accessors; the view is valid until the
+// vector is mutated or destroyed.
+template <typename T>
+struct socow_span {
+  using value_type = T;
+  using iterator = T const*;
+  using const_iterator = T const*;
+
+  socow_span() noexcept : data_(nullptr), size_(0) {}
+
+  socow_span(T const* data, size_t size) noexcept : data_(data), size_(size) {}
+
+  T const& operator[](size_t i) const {
+    assert(size_ > i);
+    return data_[i];
+  }
+
+  T const* data() const noexcept {
+    return data_;
+  }
+
+  size_t size() const noexcept {
+    return size_;
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  T const& front() const {
+    assert(size_ > 0);
+    return data_[0];
+  }
+
+  T const& back() const {
+    assert(size_ > 0);
+    return data_[size_ - 1];
+  }
+
+  iterator begin() const noexcept {
+    return data_;
+  }
+
+  iterator end() const noexcept {
+    return data_ + size_;
+  }
+
+private:
+  T const* data_;
+  size_t size_;
+};
+
+template <typename Vector>
+struct socow_pinned_span;
+
+// An immutable array made by socow_vector::freeze(). Copies share it through
+// an atomic reference counter of their own, so it can be handed to any number
+// of threads. The elements live in the heap buffer of the frozen vector; the
+// last copy to go frees it, whatever the thread.
+template <typename T>
+struct socow_snapshot {
+  using value_type = T;
+  using iterator = T const*;
+  using const_iterator = T const*;
+
+  socow_snapshot() noexcept : control_(nullptr) {}
+
+  socow_snapshot(socow_snapshot const& other) noexcept
+      : control_(other.control_) {
+    if (control_ != nullptr) {
+      control_->links.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  socow_snapshot(socow_snapshot&& other) noexcept : control_(other.control_) {
+    other.control_ = nullptr;
+  }
+
+  socow_snapshot& operator=(socow_snapshot other) noexcept {
+    std::swap(control_, other.control_);
+    return *this;
+  }
+
+  ~socow_snapshot() {
+    if (control_ != nullptr &&
+        control_->links.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      control_->destroy(control_);
+    }
+  }
+
+  T const& operator[](size_t i) const {
+    assert(size() > i);
+    return data()[i];
+  }
+
+  T const* data() const noexcept {
+    return control_ == nullptr ? nullptr : control_->data;
+  }
+
+  size_t size() const noexcept {
+    return control_ == nullptr ? 0 : control_->size;
+  }
+
+  bool empty() const noexcept {
+    return size() == 0;
+  }
+
+  T const& front() const {
+    assert(size() > 0);
+    return data()[0];
+  }
+
+  T const& back() const {
+    assert(size() > 0);
+    return data()[size() - 1];
+  }
+
+  iterator begin() const noexcept {
+    return data();
+  }
+
+  iterator end() const noexcept {
+    return data() + size();
+  }
+
+  socow_span<T> reads() const noexcept {
+    return {data(), size()};
+  }
+
+  // Copies of the same snapshot are equal in O(1).
+  friend bool operator==(socow_snapshot const& a, socow_snapshot const& b) {
+    return a.size() == b.size() && socow_equal(a.data(), b.data(), a.size());
+  }
+
+  friend bool operator!=(socow_snapshot const& a, socow_snapshot const& b) {
+    return !(a == b);
+  }
+
+private:
+  template <typename, size_t, typename, typename, typename>
+  friend struct socow_vector;
+
+  // Extended by each vector type with the buffer it hands over.
+  struct control {
+    control(T const* data, size_t size, void (*destroy)(control*) noexcept,
+            void const* owner) noexcept
+        : links(1), data(data), size(size), destroy(destroy), owner(owner) {}
+
+    std::atomic<size_t> links;
+    T const* data;
+    size_t size;
+    void (*destroy)(control*) noexcept;
+    void const* owner; // identifies the vector type that made the snapshot
+  };
+
+  explicit socow_snapshot(control* c) noexcept : control_(c) {}
+
+  control* control_;
+};
+
+// Keeps an allocator without taking any space when it is empty.
+template <typename Allocator,
+          bool = std::is_empty_v<Allocator> && !std::is_final_v<Allocator>>
+struct socow_allocator_holder : private Allocator {
+  explicit socow_allocator_holder(Allocator const& alloc) : Allocator(alloc) {}
+
+  explicit socow_allocator_holder(Allocator&& alloc)
+      : Allocator(std::move(alloc)) {}
+
+  Allocator& allocator() noexcept {
+    return *this;
+  }
+
+  Allocator const& allocator() const noexcept {
+    return *this;
+  }
+};
+
+template <typename Allocator>
+struct socow_allocator_holder<Allocator, false> {
+  explicit socow_allocator_holder(Allocator const& alloc) : alloc_(alloc) {}
+
+  explicit socow_allocator_holder(Allocator&& alloc)
+      : alloc_(std::move(alloc)) {}
+
+  Allocator& allocator() noexcept {
+    return alloc_;
+  }
+
+  Allocator const& allocator() const noexcept {
+    return alloc_;
+  }
+
+private:
+  Allocator alloc_;
+};
+
+// The allocator is used for the heap buffer (the header together with the
+// elements); elements are constructed in it with placement new. Every buffer
+// keeps a copy of the allocator that created it and is freed with that copy
+// by whichever vector drops it last. So copies may share a buffer whatever
+// their own allocators are, and buffers are swapped and moved between
+// vectors freely. A vector uses its own allocator whenever it allocates a new
+// buffer, e.g. to unshare. The allocator itself propagates on copy and move
+// assignment and on swap as the propagate_on_container_* traits say.
+template <typename T, size_t SMALL_SIZE,
+          typename RefCount = socow_plain_refcount,
+          typename Allocator = socow_allocator<T>,
+          typename Growth = socow_growth_2x<>>
+struct socow_vector : private socow_allocator_holder<Allocator> {
+  using value_type = T;
   using iterator = T*;
   using const_iterator = T const*;
+  using allocator_type = Allocator;
+
+  socow_vector() noexcept(noexcept(Allocator())) : socow_vector(Allocator()) {}
+
+  explicit socow_vector(Allocator const& alloc) noexcept
+      : socow_allocator_holder<Allocator>(alloc), size_(0), small_(true) {}
+
+  socow_vector(socow_vector const& other)
+      : socow_vector(other,
+                     alloc_traits::select_on_container_copy_construction(
+                         other.get_allocator())) {}
+
+  socow_vector(socow_vector const& other, Allocator const& alloc)
+      : socow_allocator_holder<Allocator>(alloc), size_(other.size_),
+        small_(other.small_) {
+    if (small_) {
+      if constexpr (COPY_SMALL_BLOCK) {
+        copy_small_block(other);
+      } else {
+        copy(other.begin(), other.end(), begin());
+      }
+    } else if (same_allocator(other)) {
+      new (&buffer_) buffer(other.buffer_);
+    } else {
+      // The buffer must not outlive the memory resource of `alloc`.
+      size_ = 0;
+      small_ = true;
+      construct_n(other.size_, other.cdata());
+    }
+  }
+
+  socow_vector(socow_vector&& other) noexcept(
+      std::is_nothrow_move_constructible_v<T>)
+      : socow_allocator_holder<Allocator>(std::move(other.allocator())),
+        size_(0), small_(true) {
+    steal(other);
+  }
+
+  socow_vector(size_t count, T const& value,
+               Allocator const& alloc = Allocator())
+      : socow_vector(alloc) {
+    assign_n(count, repeat_iterator{&value});
+  }
+
+  // A range of forward iterators is measured first and placed into small
+  // storage or into a single buffer of the fitting capacity.
+  template <typename InputIt,
+            typename = socow_iterator_category<InputIt>>
+  socow_vector(InputIt first, InputIt last,
+               Allocator const& alloc = Allocator())
+      : socow_vector(alloc) {
+    assign(first, last);
+  }
+
+  socow_vector(std::initializer_list<T> values,
+               Allocator const& alloc = Allocator())
+      : socow_vector(alloc) {
+    assign_n(values.size(), values.begin());
+  }
+
+  // Makes a vector with the elements of `snapshot`. A vector of the type that
+  // made the snapshot shares its buffer if the reference counting policy is
+  // thread-safe, and copies it on the first write. Otherwise the elements
+  // are copied right away.
+  explicit socow_vector(socow_snapshot<T> const& snapshot,
+                        Allocator const& alloc = Allocator())
+      : socow_vector(alloc) {
+    if constexpr (RefCount::THREAD_SAFE) {
+      if (snapshot.control_ != nullptr && snapshot.control_->owner == &TAG &&
+          static_cast<frozen const*>(snapshot.control_)
+              ->held.allocated_by(allocator())) {
+        new (&buffer_)
+            buffer(static_cast<frozen const*>(snapshot.control_)->held);
+        small_ = false;
+        size_ = snapshot.size();
+        return;
+      }
+    }
+    insert(cend(), snapshot.begin(), snapshot.end());
+  }
+
+  socow_vector& operator=(socow_vector const& other) {
+    if (this == &other) {
+      return *this;
+    }
+    socow_vector temp(other, PROPAGATE_ON_COPY ? other.allocator()
+                                               : allocator());
+    swap_storage(temp);
+    if constexpr (PROPAGATE_ON_COPY) {
+      allocator() = other.allocator();
+    }
+    return *this;
+  }
+
+  socow_vector& operator=(socow_vector&& other) noexcept(
+      (PROPAGATE_ON_MOVE || alloc_traits::is_always_equal::value) &&
+      std::is_nothrow_move_constructible_v<T>) {
+    if (this == &other) {
+      return *this;
+    }
+    if (!PROPAGATE_ON_MOVE && !other.small_ && !same_allocator(other)) {
+      // The buffer stays with its allocator: the elements are moved out of
+      // it if it is owned alone, and copied otherwise.
+      reset();
+      if (other.buffer_.unique()) {
+        construct_n(other.size_,
+                    std::make_move_iterator(other.buffer_.data()));
+      } else {
+        construct_n(other.size_, other.cdata());
+      }
+      other.reset();
+    } else {
+      reset();
+      steal(other);
+      if constexpr (PROPAGATE_ON_MOVE) {
+        allocator() = std::move(other.allocator());
+      }
+    }
+    return *this;
+  }
+
+  socow_vector& operator=(std::initializer_list<T> values) {
+    assign_n(values.size(), values.begin());
+    return *this;
+  }
+
+  // `value` may be an element of this vector.
+  void assign(size_t count, T const& value) {
+    T temp(value);
+    assign_n(count, repeat_iterator{&temp});
+  }
+
+  // The range must not refer to this vector.
+  template <typename InputIt,
+            typename = socow_iterator_category<InputIt>>
+  void assign(InputIt first, InputIt last) {
+    if constexpr (std::is_base_of_v<std::forward_iterator_tag,
+                                    socow_iterator_category<InputIt>>) {
+      assign_n(std::distance(first, last), first);
+    } else {
+      if (small_ || buffer_.unique()) {
+        clear();
+      } else {
+        reset();
+      }
+      for (; first != last; ++first) {
+        emplace_back(*first);
+      }
+    }
+  }
+
+  void assign(std::initializer_list<T> values) {
+    assign_n(values.size(), values.begin());
+  }
+
+  ~socow_vector() {
+    if (small_) {
+      destroy_elements(begin(), end());
+    } else {
+      destroy_buffer();
+    }
+    size_ = 0;
+  }
+
+  allocator_type get_allocator() const {
+    return allocator();
+  }
+
+  T& operator[](size_t i) {
+    assert(size_ > i);
+    return data()[i];
+  }
+
+  T const& operator[](size_t i) const {
+    assert(size_ > i);
+    return cdata()[i];
+  }
+
+  T* data() {
+    if (small_) {
+      return static_buffer_.data();
+    }
+    unshare();
+    forget();
+    return buffer_.data();
+  }
+
+  T const* data() const {
+    return cdata();
+  }
+
+  T const* cdata() const {
+    return (small_ ? static_buffer_.data() : buffer_.data());
+  }
+
+  // Turns the vector into an immutable snapshot and leaves it empty. A heap
+  // buffer is handed over as is when this vector owns it alone, or when the
+  // policy lets other owners on other threads share it; otherwise the
+  // elements are copied or relocated into a buffer of their own first.
+  socow_snapshot<T> freeze() {
+    if (size_ == 0) {
+      clear();
+      return {};
+    }
+    if (small_ || !(RefCount::THREAD_SAFE || buffer_.unique())) {
+      realloc(size_);
+    }
+    frozen* result = new frozen(std::move(buffer_), size_);
+    buffer_.~buffer();
+    small_ = true;
+    size_ = 0;
+    return socow_snapshot<T>(result);
+  }
+
+  // Reads the elements without unsharing them, even through a non-const
+  // vector. The view is invalidated by any mutation of the vector.
+  socow_span<T> reads() const noexcept {
+    return {cdata(), size_};
+  }
+
+  // Like reads(), but the view shares the buffer of the vector, or copies
+  // its small storage, and so outlives any mutation of it.
+  socow_pinned_span<socow_vector> pinned_reads() const {
+    return socow_pinned_span<socow_vector>(*this);
+  }
+
+  const_iterator cbegin() const {
+    return cdata();
+  }
+
+  const_iterator cend() const {
+    return cdata() + size_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  T& front() {
+    assert(size_ > 0);
+    return data()[0];
+  }
+
+  T const& front() const {
+    assert(size_ > 0);
+    return cdata()[0];
+  }
+
+  T& back() {
+    assert(size_ > 0);
+    return data()[size_ - 1];
+  }
+
+  T const& back() const {
+    assert(size_ > 0);
+    return cdata()[size_ - 1];
+  }
+
+  void push_back(T const& e) {
+    emplace_back(e);
+  }
+
+  void push_back(T&& e) {
+    emplace_back(std::move(e));
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    T* result;
+    if (size_ != capacity()) {
+      result = new (end()) T(std::forward<Args>(args)...);
+    } else if (REALLOCATE && !small_ && buffer_.unique()) {
+      // The elements may move, so the new one is made before.
+      T temp(std::forward<Args>(args)...);
+      reallocate(grown_capacity(size_ + 1));
+      forget();
+      result = new (buffer_.data() + size_) T(std::move(temp));
+    } else {
+      // The new element is constructed before the old ones are touched, so
+      // `args` may safely refer to elements of this vector.
+      buffer new_buffer(grown_capacity(size_ + 1), allocator());
+      result = new (new_buffer.data() + size_) T(std::forward<Args>(args)...);
+      try {
+        realloc(std::move(new_buffer), size_, 0);
+      } catch (...) {
+        result->~T();
+        throw;
+      }
+    }
+    ++size_;
+    return *result;
+  }
+
+  void pop_back() {
+    assert(size_ > 0);
+    if (small_ || buffer_.unique()) {
+      forget();
+      size_--;
+      cend()->~T();
+    } else {
+      unshare_prefix(size_ - 1);
+    }
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  size_t capacity() const {
+    return (small_ ? SMALL_SIZE : buffer_.capacity());
+  }
+
+  void reserve(size_t new_cap) {
+    if (new_cap > capacity() ||
+        (!small_ && new_cap >= size_ && new_cap != 0 && !buffer_.unique())) {
+      realloc(new_cap > capacity() ? Growth::fit(new_cap, buffer::header_size(),
+                                                 sizeof(T))
+                                   : new_cap);
+    }
+  }
+
+  void shrink_to_fit() {
+    if (!small_) {
+      if (size_ <= SMALL_SIZE) {
+        buffer temp(std::move(buffer_));
+        buffer_.~buffer();
+        bool owned = temp.unique();
+        try {
+          if (owned) {
+            relocate(temp.data(), temp.data() + size_, static_buffer_.begin());
+          } else {
+            copy(temp.data(), temp.data() + size_, static_buffer_.begin());
+          }
+        } catch (...) {
+          new (&buffer_) buffer(std::move(temp));
+          throw;
+        }
+        temp.release(owned ? 0 : size_);
+        small_ = true;
+        record(socow_event::big_to_small);
+        if (!owned) {
+          record_unshare(size_);
+        }
+      } else if (size_ != buffer_.capacity()) {
+        realloc(size_);
+      }
+    }
+  }
 
-  socow_vector() {}
+  // The new elements are value-initialized. Large arrays of arithmetic
+  // elements come zero-filled from the allocator when it can provide that.
+  void resize(size_t n) {
+    resize_with(n, ZERO_FILLED, [](T* first, size_t count) {
+      std::uninitialized_value_construct_n(first, count);
+    });
+  }
 
-  socow_vector(socow_vector const& other)
-      : size_(other.size_), small_(other.small_) {
-    if (small_) {
-      copy(other.begin(), other.end(), begin());
+  // `value` may be an element of this vector.
+  void resize(size_t n, T const& value) {
+    resize_with(n, false, [&value](T* first, size_t count) {
+      std::uninitialized_fill_n(first, count, value);
+    });
+  }
+
+  // The new elements are default-initialized, which leaves trivially
+  // constructible ones uninitialized, for storage about to be overwritten.
+  void resize_default_init(size_t n) {
+    resize_with(n, false, [](T* first, size_t count) {
+      std::uninitialized_default_construct_n(first, count);
+    });
+  }
+
+  void clear() {
+    if (small_ || buffer_.unique()) {
+      destroy_elements(begin(), end());
+      size_ = 0;
     } else {
-      new (&buffer_) buffer(other.buffer_);
+      unshare_prefix(0);
     }
   }
 
-  socow_vector& operator=(socow_vector const& other) {
-    if (this == &other) {
-      return *this;
+  void swap(socow_vector& other) {
+    swap_storage(other);
+    if constexpr (PROPAGATE_ON_SWAP) {
+      using std::swap;
+      swap(allocator(), other.allocator());
     }
-    socow_vector temp = socow_vector(other);
-    temp.swap(*this);
-    return *this;
   }
 
-  ~socow_vector() {
+  iterator begin() {
+    return data();
+  }
+
+  iterator end() {
+    return data() + size_;
+  }
+
+  const_iterator begin() const {
+    return cbegin();
+  }
+
+  const_iterator end() const {
+    return cend();
+  }
+
+  iterator insert(const_iterator pos, T const& value) {
+    return emplace(pos, value);
+  }
+
+  iterator insert(const_iterator pos, T&& value) {
+    return emplace(pos, std::move(value));
+  }
+
+  iterator insert(const_iterator pos, size_t count, T const& value) {
+    size_t index = pos - cbegin();
+    if (count == 0) {
+      return begin() + index;
+    }
+    // `value` may be an element that the insertion moves or destroys.
+    T temp(value);
+    return insert_n(index, count, repeat_iterator{&temp});
+  }
+
+  template <typename InputIt,
+            typename = socow_iterator_category<InputIt>>
+  iterator insert(const_iterator pos, InputIt first, InputIt last) {
+    size_t index = pos - cbegin();
+    if constexpr (std::is_base_of_v<std::forward_iterator_tag,
+                                    socow_iterator_category<InputIt>>) {
+      return insert_n(index, std::distance(first, last), first);
+    } else {
+      socow_vector temp(allocator());
+      for (; first != last; ++first) {
+        temp.emplace_back(*first);
+      }
+      return insert_n(index, temp.size(),
+                      std::make_move_iterator(temp.begin()));
+    }
+  }
+
+  iterator insert(const_iterator pos, std::initializer_list<T> values) {
+    return insert_n(pos - cbegin(), values.size(), values.begin());
+  }
+
+  template <typename InputIt,
+            typename = socow_iterator_category<InputIt>>
+  void append(InputIt first, InputIt last) {
+    insert(cend(), first, last);
+  }
+
+  template <typename... Args>
+  iterator emplace(const_iterator pos, Args&&... args) {
+    size_t index = pos - cbegin();
+    if (index == size_) {
+      emplace_back(std::forward<Args>(args)...);
+    } else if (size_ == capacity() || !(small_ || buffer_.unique())) {
+      buffer new_buffer(
+          size_ == capacity() ? grown_capacity(size_ + 1) : capacity(),
+          allocator());
+      T* dest = new_buffer.data();
+      new (dest + index) T(std::forward<Args>(args)...);
+      try {
+        realloc(std::move(new_buffer), index, 1);
+      } catch (...) {
+        dest[index].~T();
+        throw;
+      }
+      ++size_;
+    } else {
+      T temp(std::forward<Args>(args)...);
+      T* first = data() + index;
+      T* last = data() + size_;
+      new (last) T(std::move(*(last - 1)));
+      ++size_;
+      std::move_backward(first, last - 1, last);
+      *first = std::move(temp);
+    }
+    return begin() + index;
+  }
+
+  iterator erase(const_iterator pos) {
+    return erase(pos, pos + 1);
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    size_t index = first - cbegin();
+    size_t count = last - first;
+    if (count == 0) {
+      return begin() + index;
+    }
     if (small_ || buffer_.unique()) {
-      destroy_elements(begin(), end());
+      forget();
+      T* elements = small_ ? static_buffer_.data() : buffer_.data();
+      std::move(elements + index + count, elements + size_, elements + index);
+      destroy_elements(elements + size_ - count, elements + size_);
+    } else {
+      // The remaining elements are copied straight into a new buffer instead
+      // of unsharing everything first.
+      buffer new_buffer(buffer_.capacity(), allocator());
+      T* dest = new_buffer.data();
+      const_iterator source = buffer_.data();
+      record_unshare(size_ - count);
+      copy(source, source + index, dest);
+      try {
+        copy(source + index + count, source + size_, dest + index);
+      } catch (...) {
+        destroy_elements(dest, dest + index);
+        throw;
+      }
+      buffer_.release(size_);
+      buffer_.~buffer();
+      new (&buffer_) buffer(std::move(new_buffer));
+    }
+    size_ -= count;
+    return begin() + index;
+  }
+
+  // The value `compute(reads())` returns. With a socow_memoized policy it is
+  // computed once per heap buffer and kept in it for every vector sharing
+  // it, until this vector hands out mutable access to its elements through
+  // data(), operator[], begin() and the like. `key` tells the values apart,
+  // e.g. the address of an object of the caller. A write through a
+  // reference, pointer or iterator taken before the lookup goes unnoticed
+  // and leaves the value stale: take it again after the lookup to write.
+  template <typename Compute>
+  size_t memo(void const* key, Compute compute) const {
+    if constexpr (MEMOIZED) {
+      if (!small_) {
+        return buffer_.memo().get(key, [&] { return compute(reads()); });
+      }
+    }
+    return compute(reads());
+  }
+
+  // Comparing never unshares. Vectors sharing a buffer compare their sizes
+  // only, unless socow_has_reflexive_equality says an element may differ
+  // from itself; then they compare their elements as other vectors do.
+  friend bool operator==(socow_vector const& a, socow_vector const& b) {
+    return a.size_ == b.size_ && socow_equal(a.cdata(), b.cdata(), a.size_);
+  }
+
+  friend bool operator!=(socow_vector const& a, socow_vector const& b) {
+    return !(a == b);
+  }
+
+  // Unordered elements such as NaN are skipped by lexicographical_compare
+  // too, so on a shared buffer it always comes down to the sizes.
+  friend bool operator<(socow_vector const& a, socow_vector const& b) {
+    if (a.cdata() == b.cdata()) {
+      return a.size_ < b.size_;
+    }
+    return std::lexicographical_compare(a.cbegin(), a.cend(), b.cbegin(),
+                                        b.cend());
+  }
+
+  friend bool operator>(socow_vector const& a, socow_vector const& b) {
+    return b < a;
+  }
+
+  friend bool operator<=(socow_vector const& a, socow_vector const& b) {
+    return !(b < a);
+  }
+
+  friend bool operator>=(socow_vector const& a, socow_vector const& b) {
+    return !(a < b);
+  }
+
+#ifdef __cpp_lib_three_way_comparison
+  friend auto operator<=>(socow_vector const& a, socow_vector const& b)
+    requires std::three_way_comparable<T>
+  {
+    using result = std::compare_three_way_result_t<T>;
+    if constexpr (socow_has_reflexive_equality<T>::value) {
+      if (a.cdata() == b.cdata()) {
+        return result(a.size_ <=> b.size_);
+      }
+    }
+    return std::lexicographical_compare_three_way(
+        a.cbegin(), a.cend(), b.cbegin(), b.cend(), std::compare_three_way());
+  }
+#endif
+
+#ifdef SOCOW_VECTOR_STATS
+  // The runtime counters of this instantiation.
+  static socow_counters& stats() {
+    static socow_counters& counters =
+        socow_stats_registry::instance().counters(typeid(socow_vector));
+    return counters;
+  }
+#endif
+
+private:
+  using alloc_traits = std::allocator_traits<Allocator>;
+  using socow_allocator_holder<Allocator>::allocator;
+
+  static constexpr bool PROPAGATE_ON_COPY =
+      alloc_traits::propagate_on_container_copy_assignment::value;
+  static constexpr bool PROPAGATE_ON_MOVE =
+      alloc_traits::propagate_on_container_move_assignment::value;
+  static constexpr bool PROPAGATE_ON_SWAP =
+      alloc_traits::propagate_on_container_swap::value;
+
+  // Small storage of trivially copyable elements is copied as a whole when
+  // it fits into a cache line: a fixed-size memcpy is cheaper than a loop
+  // bounded by `size_`.
+  static constexpr bool COPY_SMALL_BLOCK =
+      std::is_trivially_copyable_v<T> &&
+      sizeof(std::array<T, SMALL_SIZE>) <= 64;
+
+  // Value-initialized elements are all zero bits, and are worth taking
+  // from zero-filled memory once they span a page.
+  static constexpr bool ZERO_FILLED =
+      std::is_arithmetic_v<T> &&
+      socow_has_allocate_zeroed_at_least<Allocator>::value;
+  static constexpr size_t ZERO_FILL_BYTES = 4096;
+
+  using size_type = typename RefCount::size_type;
+
+  static constexpr bool MEMOIZED = socow_has_memo<RefCount>::value;
+
+  // Whether a buffer owned alone can be resized by the allocator, moving
+  // the header and the elements bytewise.
+  static constexpr bool REALLOCATE =
+      socow_has_reallocate_at_least<Allocator>::value &&
+      socow_is_trivially_relocatable<T>::value &&
+      socow_is_trivially_relocatable<Allocator>::value;
+
+  // Whether the buffers may be reclaimed on another thread, after this
+  // vector is gone: their elements must allow it, and the allocator must
+  // not refer to a memory resource that could be gone by then.
+  static constexpr bool DEFERRABLE =
+      socow_is_thread_independent<T>::value &&
+      alloc_traits::is_always_equal::value;
+
+  struct buffer {
+    buffer() : buffer_data_(nullptr) {}
+
+    // The elements of a `zeroed` buffer are zero-filled.
+    buffer(size_t capacity, Allocator const& alloc, bool zeroed = false) {
+      if (capacity > std::numeric_limits<size_type>::max()) {
+        throw std::length_error("socow_vector: capacity is too large");
+      }
+      block_allocator blocks_alloc(alloc);
+      block* memory;
+      if constexpr (ZEROED_ALLOCATION) {
+        // Takes the slack of the size class as extra capacity.
+        auto result =
+            zeroed ? blocks_alloc.allocate_zeroed_at_least(blocks(capacity))
+                   : blocks_alloc.allocate_at_least(blocks(capacity));
+        memory = result.ptr;
+        capacity = std::min<size_t>(
+            (result.count * sizeof(block) - sizeof(buffer_data)) / sizeof(T),
+            std::numeric_limits<size_type>::max());
+      } else if constexpr (socow_has_allocate_at_least<
+                               block_allocator>::value) {
+        auto result = blocks_alloc.allocate_at_least(blocks(capacity));
+        memory = result.ptr;
+        capacity = std::min<size_t>(
+            (result.count * sizeof(block) - sizeof(buffer_data)) / sizeof(T),
+            std::numeric_limits<size_type>::max());
+      } else {
+        memory = block_traits::allocate(blocks_alloc, blocks(capacity));
+      }
+      buffer_data_ =
+          new (memory) buffer_data(std::move(blocks_alloc), capacity);
+      if (zeroed && !ZEROED_ALLOCATION) {
+        std::memset(static_cast<void*>(data()), 0, sizeof(T) * capacity);
+      }
+      record(socow_event::allocation);
+    }
+
+    buffer(buffer const& other) : buffer_data_(other.buffer_data_) {
+      RefCount::acquire(buffer_data_->links);
+      record_links(buffer_data_->links);
+    }
+
+    buffer(buffer&& other) noexcept : buffer_data_(other.buffer_data_) {
+      other.buffer_data_ = nullptr;
+    }
+
+    buffer& operator=(buffer const& other) = delete;
+
+    // The buffer must not hold elements anymore, unless other owners remain.
+    ~buffer() {
+      release(0);
+    }
+
+    // Drops this reference to the buffer. The last owner destroys the first
+    // `size` elements and frees the memory, or hands a big buffer to the
+    // reclaimer of socow_deferred to do so.
+    void release(size_t size) noexcept {
+      if (buffer_data_ != nullptr &&
+          (unique() || RefCount::release(buffer_data_->links))) {
+        if (!defer(size)) {
+          reclaim(buffer_data_, size);
+        }
+      }
+      buffer_data_ = nullptr;
+    }
+
+    // Hands this unreferenced buffer to the reclaimer of socow_deferred, if
+    // DEFERRABLE and it takes the buffer.
+    bool defer(size_t size) noexcept {
+      if constexpr (DEFERRABLE) {
+        socow_reclaimer* reclaimer =
+            socow_deferred::reclaimer_for(sizeof(T) * capacity());
+        return reclaimer != nullptr &&
+               reclaimer->defer(&reclaim, buffer_data_, size);
+      } else {
+        return false;
+      }
+    }
+
+    // Destroys the first `size` elements of an unreferenced buffer and frees
+    // its memory.
+    static void reclaim(void* data, size_t size) noexcept {
+      buffer_data* header = static_cast<buffer_data*>(data);
+      destroy_elements(header->data_, header->data_ + size);
+      block_allocator blocks_alloc(std::move(header->allocator()));
+      size_t count = blocks(header->capacity_);
+      header->~buffer_data();
+      block_traits::deallocate(blocks_alloc, reinterpret_cast<block*>(header),
+                               count);
+      record(socow_event::free);
+    }
+
+    // Moves the elements and the header, bytewise, to a block of at least
+    // `capacity` elements with the allocator of the buffer, which must be
+    // owned alone. Provides the strong guarantee. Only instantiated for
+    // allocators that provide reallocate_at_least.
+    template <bool ENABLED = true>
+    void reallocate(size_t capacity) {
+      using Alloc = std::conditional_t<ENABLED, block_allocator, void>;
+      if (capacity > std::numeric_limits<size_type>::max()) {
+        throw std::length_error("socow_vector: capacity is too large");
+      }
+      Alloc blocks_alloc(buffer_data_->allocator());
+      auto result = blocks_alloc.reallocate_at_least(
+          reinterpret_cast<block*>(buffer_data_),
+          blocks(buffer_data_->capacity_), blocks(capacity));
+      buffer_data_ = reinterpret_cast<buffer_data*>(result.ptr);
+      buffer_data_->capacity_ = static_cast<size_type>(std::min<size_t>(
+          (result.count * sizeof(block) - sizeof(buffer_data)) / sizeof(T),
+          std::numeric_limits<size_type>::max()));
+    }
+
+    void swap(buffer& other) noexcept {
+      std::swap(buffer_data_, other.buffer_data_);
+    }
+
+    size_t capacity() const {
+      return buffer_data_->capacity_;
+    }
+
+    T* data() {
+      return buffer_data_->data_;
+    }
+
+    T* data() const {
+      return buffer_data_->data_;
+    }
+
+    bool unique() const {
+      return RefCount::unique(buffer_data_->links);
+    }
+
+    // Whether `alloc` can free this buffer.
+    bool allocated_by(Allocator const& alloc) const {
+      if constexpr (alloc_traits::is_always_equal::value) {
+        return true;
+      } else {
+        return Allocator(buffer_data_->allocator()) == alloc;
+      }
+    }
+
+    // Only instantiated for socow_memoized policies.
+    template <typename Policy = RefCount>
+    socow_memo& memo() const {
+      return Policy::memo(buffer_data_->links);
+    }
+
+    static size_t header_size() {
+      return sizeof(buffer_data);
+    }
+
+  private:
+    // The unit of allocation, aligned for every part of the buffer.
+    struct alignas(std::max({alignof(T), alignof(typename RefCount::counter),
+                             alignof(size_type), alignof(Allocator)})) block {};
+
+    using block_allocator =
+        typename alloc_traits::template rebind_alloc<block>;
+    using block_traits = std::allocator_traits<block_allocator>;
+
+    static constexpr bool ZEROED_ALLOCATION =
+        socow_has_allocate_at_least<block_allocator>::value &&
+        socow_has_allocate_zeroed_at_least<block_allocator>::value;
+
+    static_assert(std::is_same_v<typename block_traits::pointer, block*>,
+                  "allocators with fancy pointers are not supported");
+
+    struct buffer_data : socow_allocator_holder<block_allocator> {
+      buffer_data(block_allocator&& alloc, size_t capacity)
+          : socow_allocator_holder<block_allocator>(std::move(alloc)),
+            links(1), capacity_(static_cast<size_type>(capacity)) {}
+
+      typename RefCount::counter links;
+      size_type capacity_;
+      T data_[0];
+    };
+
+    static_assert(alignof(buffer_data) <= alignof(block));
+
+    static size_t blocks(size_t capacity) {
+      return (sizeof(buffer_data) + sizeof(T) * capacity + sizeof(block) - 1) /
+             sizeof(block);
+    }
+
+    buffer_data* buffer_data_;
+  };
+
+  // Yields the same value over and over, to insert copies of it as a range.
+  struct repeat_iterator {
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T const*;
+    using reference = T const&;
+
+    T const& operator*() const {
+      return *value;
+    }
+
+    repeat_iterator& operator++() {
+      return *this;
+    }
+
+    T const* value;
+  };
+
+  // Inserts `count` elements taken from `first` at `index`, moving the tail
+  // or reallocating only once. When the buffer is shared or too small, the
+  // new elements are constructed in the new buffer first and the old ones
+  // are placed around them. The range must not refer to this vector.
+  template <typename It>
+  iterator insert_n(size_t index, size_t count, It first) {
+    if (count == 0) {
+      return begin() + index;
+    }
+    if (index == size_ && size_ + count > capacity()) {
+      reallocate(grown_capacity(size_ + count));
+    }
+    if (size_ + count > capacity() || !(small_ || buffer_.unique())) {
+      size_t new_capacity = size_ + count > capacity()
+                                ? grown_capacity(size_ + count)
+                                : capacity();
+      buffer new_buffer(new_capacity, allocator());
+      T* gap = new_buffer.data() + index;
+      copy_n(first, count, gap);
+      try {
+        realloc(std::move(new_buffer), index, count);
+      } catch (...) {
+        destroy_elements(gap, gap + count);
+        throw;
+      }
+      size_ += count;
+    } else {
+      T* pos = data() + index;
+      T* last = data() + size_;
+      size_t after = size_ - index;
+      if (after > count) {
+        move(last - count, last, last);
+        size_ += count;
+        std::move_backward(pos, last - count, last);
+        std::copy_n(first, count, pos);
+      } else {
+        It middle = first;
+        for (size_t i = 0; i != after; ++i) {
+          ++middle;
+        }
+        copy_n(middle, count - after, last);
+        size_ += count - after;
+        move(pos, last, pos + count);
+        size_ += after;
+        std::copy_n(first, after, pos);
+      }
+    }
+    return begin() + index;
+  }
+
+  // Shrinks the vector to `n` elements, or grows it with `construct(first,
+  // count)` placing the new ones. The elements are constructed before the old
+  // ones are touched, so `construct` may read them. When the new elements
+  // are `zero` and the vector moves to a new buffer, they are left as the
+  // allocator zero-filled them instead.
+  template <typename Construct>
+  void resize_with(size_t n, bool zero, Construct construct) {
+    if (n <= size_) {
+      erase(cbegin() + n, cend());
+      return;
+    }
+    size_t count = n - size_;
+    if (n > capacity()) {
+      reallocate(grown_capacity(n));
+    }
+    if (n > capacity() || !(small_ || buffer_.unique())) {
+      bool zeroed = zero && sizeof(T) * count >= ZERO_FILL_BYTES;
+      buffer new_buffer(n > capacity() ? grown_capacity(n) : capacity(),
+                        allocator(), zeroed);
+      T* gap = new_buffer.data() + size_;
+      if (!zeroed) {
+        construct(gap, count);
+      }
+      try {
+        realloc(std::move(new_buffer), size_, count);
+      } catch (...) {
+        destroy_elements(gap, gap + count);
+        throw;
+      }
+    } else {
+      construct(data() + size_, count);
+    }
+    size_ = n;
+  }
+
+  // Replaces the elements with `count` ones taken from `first`. Storage this
+  // vector owns alone is reused when they fit in it: the old elements are
+  // assigned to and the rest constructed or destroyed. Otherwise the new
+  // elements are constructed in small storage or in a buffer of the fitting
+  // capacity, which is the only allocation.
+  template <typename It>
+  void assign_n(size_t count, It first) {
+    if (count <= capacity() && (small_ || buffer_.unique())) {
+      forget();
+      T* dest = small_ ? static_buffer_.data() : buffer_.data();
+      size_t common = std::min<size_t>(size_, count);
+      for (size_t i = 0; i != common; ++i, ++first) {
+        dest[i] = *first;
+      }
+      if (count > size_) {
+        copy_n(first, count - size_, dest + size_);
+      } else {
+        destroy_elements(dest + count, dest + size_);
+      }
+      size_ = count;
+    } else {
+      socow_vector temp(allocator());
+      if (count > SMALL_SIZE) {
+        new (&temp.buffer_)
+            buffer(Growth::fit(count, buffer::header_size(), sizeof(T)),
+                   allocator());
+        temp.small_ = false;
+      }
+      temp.copy_n(first, count, temp.small_ ? temp.static_buffer_.data()
+                                            : temp.buffer_.data());
+      temp.size_ = count;
+      swap_storage(temp);
+    }
+  }
+
+  // Fills this small and empty vector with `count` elements taken from
+  // `first`, in small storage or in a buffer of the fitting capacity.
+  template <typename It>
+  void construct_n(size_t count, It first) {
+    if (count <= SMALL_SIZE) {
+      copy_n(first, count, static_buffer_.data());
+    } else {
+      new (&buffer_)
+          buffer(Growth::fit(count, buffer::header_size(), sizeof(T)),
+                 allocator());
+      small_ = false;
+      try {
+        copy_n(first, count, buffer_.data());
+      } catch (...) {
+        destroy_buffer();
+        small_ = true;
+        throw;
+      }
+    }
+    size_ = count;
+  }
+
+  // Constructs `count` elements taken from `first` at `dest`.
+  template <typename It>
+  void copy_n(It first, size_t count, iterator dest) {
+    if constexpr (std::is_same_v<It, iterator> ||
+                  std::is_same_v<It, const_iterator>) {
+      copy(first, first + count, dest);
+    } else {
+      for (size_t i = 0; i != count; ++i, ++first) {
+        try {
+          new (dest + i) T(*first);
+        } catch (...) {
+          destroy_elements(dest, dest + i);
+          throw;
+        }
+      }
+    }
+  }
+
+  // Makes `new_buffer` the storage of this vector. The elements are placed
+  // into it leaving `count` uninitialized slots starting at `index`; the size
+  // is left as is. Elements of storage this vector owns alone are relocated,
+  // those of a shared buffer are copied. Provides the strong guarantee.
+  void realloc(buffer&& new_buffer, size_t index, size_t count) {
+    iterator dest = new_buffer.data();
+    bool owned = small_ || buffer_.unique();
+    if (owned) {
+      iterator first = small_ ? static_buffer_.begin() : buffer_.data();
+      relocate_around(first, first + size_, index, count, dest);
+      record(socow_event::move_bytes, sizeof(T) * size_);
+      if (small_) {
+        record(socow_event::small_to_big);
+      }
+    } else {
+      record_unshare(size_);
+      const_iterator first = buffer_.data();
+      copy(first, first + index, dest);
+      try {
+        copy(first + index, first + size_, dest + index + count);
+      } catch (...) {
+        destroy_elements(dest, dest + index);
+        throw;
+      }
     }
     if (!small_) {
+      buffer_.release(owned ? 0 : size_);
       buffer_.~buffer();
     }
-    size_ = 0;
+    new (&buffer_) buffer(std::move(new_buffer));
+    small_ = false;
   }
 
-  T& operator[](size_t i) {
-    assert(size_ > i);
-    return data()[i];
+#ifdef SOCOW_VECTOR_STATS
+  static void record(socow_event event, size_t n = 1) noexcept {
+    stats().record(event, n);
   }
 
-  T const& operator[](size_t i) const {
-    assert(size_ > i);
-    return cdata()[i];
+  // Reads the counter only when the stats are kept.
+  static void record_links(typename RefCount::counter const& links) noexcept {
+    stats().record_links(RefCount::count(links));
   }
+#else
+  static void record(socow_event, size_t = 1) noexcept {}
 
-  T* data() {
-    if (small_) {
-      return static_buffer_.data();
-    }
-    unshare();
-    return buffer_.data();
-  }
+  static void record_links(typename RefCount::counter const&) noexcept {}
+#endif
 
-  T const* data() const {
-    return cdata();
+  static void record_unshare(size_t count) noexcept {
+    record(socow_event::unshare);
+    record(socow_event::unshare_bytes, sizeof(T) * count);
   }
 
-  T const* cdata() const {
-    return (small_ ? static_buffer_.data() : buffer_.data());
-  }
+  // The owner of a buffer handed to snapshots.
+  struct frozen : socow_snapshot<T>::control {
+    frozen(buffer&& frozen_buffer, size_t size)
+        : socow_snapshot<T>::control(frozen_buffer.data(), size, &destroy,
+                                     &TAG),
+          held(std::move(frozen_buffer)) {}
 
-  const_iterator cbegin() const {
-    return cdata();
+    static void destroy(typename socow_snapshot<T>::control* c) noexcept {
+      frozen* f = static_cast<frozen*>(c);
+      f->held.release(f->size);
+      delete f;
+    }
+
+    buffer held;
+  };
+
+  // Its address tells snapshots made by this vector type apart.
+  static constexpr char TAG = 0;
+
+  // Drops the memoized values of a buffer about to be written to, which this
+  // vector must own alone.
+  void forget() noexcept {
+    if constexpr (MEMOIZED) {
+      if (!small_) {
+        buffer_.memo().forget();
+      }
+    }
   }
 
-  const_iterator cend() const {
-    return cdata() + size_;
+  // The capacity to grow into when `required` elements must fit.
+  size_t grown_capacity(size_t required) const {
+    return Growth::grow(capacity(), required, small_, buffer::header_size(),
+                        sizeof(T));
   }
 
-  size_t size() const {
-    return size_;
+  void realloc(size_t new_capacity) {
+    if (!reallocate(new_capacity)) {
+      realloc(buffer(new_capacity, allocator()), size_, 0);
+    }
   }
 
-  T& front() {
-    assert(size_ > 0);
-    return data()[0];
+  // Resizes the heap buffer with the allocator that made it, when this
+  // vector owns it alone and REALLOCATE allows. Returns false otherwise.
+  bool reallocate(size_t new_capacity) {
+    if constexpr (REALLOCATE) {
+      if (!small_ && buffer_.unique()) {
+        buffer_.reallocate(new_capacity);
+        return true;
+      }
+    }
+    return false;
   }
 
-  T const& front() const {
-    assert(size_ > 0);
-    return cdata()[0];
+  void unshare() {
+    if (!small_ && !buffer_.unique()) {
+      realloc(buffer_.capacity());
+    }
   }
 
-  T& back() {
-    assert(size_ > 0);
-    return data()[size_ - 1];
+  // Replaces the shared buffer with one of the same capacity holding copies
+  // of the first `count` elements only, so that dropping the tail of a
+  // shared vector does not copy the elements it drops.
+  void unshare_prefix(size_t count) {
+    record_unshare(count);
+    buffer new_buffer(buffer_.capacity(), allocator());
+    copy(buffer_.data(), buffer_.data() + count, new_buffer.data());
+    destroy_buffer();
+    new (&buffer_) buffer(std::move(new_buffer));
+    size_ = count;
   }
 
-  T const& back() const {
-    assert(size_ > 0);
-    return cdata()[size_ - 1];
+  void copy(const_iterator begin, const_iterator end, iterator dest) {
+    if constexpr (socow_is_thread_independent<T>::value) {
+      if (socow_executor* executor =
+              socow_parallel::executor_for(sizeof(T) * (end - begin))) {
+        copy_parallel(begin, end, dest, *executor);
+        return;
+      }
+    }
+    copy_serial(begin, end, dest);
   }
 
-  void push_back(T const& e) {
-    if (size_ != capacity()) {
-      new (end()) T(e);
-    } else {
-      buffer new_buffer(2 * capacity());
-      copy(cbegin(), cend(), new_buffer.data());
+  // Copies a chunk per task. A chunk that throws destroys what it made; the
+  // other chunks are then destroyed and its exception rethrown.
+  static void copy_parallel(const_iterator begin, const_iterator end,
+                            iterator dest, socow_executor& executor) {
+    size_t n = end - begin;
+    size_t chunks = std::max<size_t>(1, executor.concurrency());
+    std::unique_ptr<std::exception_ptr[]> errors(
+        new std::exception_ptr[chunks]);
+    struct {
+      const_iterator begin;
+      iterator dest;
+      size_t n, chunks;
+      std::exception_ptr* errors;
+    } job{begin, dest, n, chunks, errors.get()};
+    // Captures a single pointer, which std::function stores in place.
+    executor.run(chunks, [job = &job](size_t c) {
+      size_t first = job->n * c / job->chunks;
+      size_t last = job->n * (c + 1) / job->chunks;
       try {
-        new (new_buffer.data() + size_) T(e);
+        copy_serial(job->begin + first, job->begin + last, job->dest + first);
       } catch (...) {
-        destroy_buffer();
-        throw;
+        job->errors[c] = std::current_exception();
       }
-      if (!small_) {
-        destroy_buffer();
-      } else {
-        destroy_elements(begin(), end());
+    });
+    for (size_t c = 0; c != chunks; ++c) {
+      if (errors[c]) {
+        for (size_t other = 0; other != chunks; ++other) {
+          if (!errors[other]) {
+            destroy_elements(dest + n * other / chunks,
+                             dest + n * (other + 1) / chunks);
+          }
+        }
+        std::rethrow_exception(errors[c]);
       }
-      new (&buffer_) buffer(new_buffer);
-      small_ = false;
     }
-    ++size_;
   }
 
-  void pop_back() {
-    unshare();
-    size_--;
-    cend()->~T();
+  static void copy_serial(const_iterator begin, const_iterator end,
+                          iterator dest) {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      if (begin != end) {
+        std::memcpy(dest, begin, sizeof(T) * (end - begin));
+      }
+    } else {
+      for (const_iterator it = begin; it < end; it++) {
+        try {
+          new (dest + (it - begin)) T(*it);
+        } catch (...) {
+          destroy_elements(dest, dest + (it - begin));
+          throw;
+        }
+      }
+    }
   }
 
-  bool empty() const {
-    return size() == 0;
+  void move(iterator begin, iterator end, iterator dest) {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      copy(begin, end, dest);
+    } else {
+      for (iterator it = begin; it < end; it++) {
+        try {
+          new (dest + (it - begin)) T(std::move(*it));
+        } catch (...) {
+          destroy_elements(dest, dest + (it - begin));
+          throw;
+        }
+      }
+    }
   }
 
-  size_t capacity() const {
-    return (small_ ? SMALL_SIZE : buffer_.capacity());
+  // Falls back to copying when moving could throw, so that the source is
+  // left untouched and the caller can keep the strong guarantee.
+  void move_if_noexcept(iterator begin, iterator end, iterator dest) {
+    if constexpr (std::is_nothrow_move_constructible_v<T> ||
+                  !std::is_copy_constructible_v<T>) {
+      move(begin, end, dest);
+    } else {
+      copy(begin, end, dest);
+    }
   }
 
-  void reserve(size_t new_cap) {
-    if (small_ && new_cap > SMALL_SIZE) {
-      make_big(new_cap);
-    } else if (!small_ && new_cap >= size_ && !buffer_.unique()) {
-      new (&buffer_) buffer(realloc(new_cap, cbegin(), cend()));
+  // Moves the elements to `dest` and ends the lifetime of the source ones,
+  // so the source storage can be freed without destroying anything.
+  // If an exception is thrown, the source is left untouched.
+  void relocate(iterator begin, iterator end, iterator dest) {
+    if constexpr (socow_is_trivially_relocatable<T>::value) {
+      if (begin != end) {
+        std::memcpy(static_cast<void*>(dest), static_cast<void*>(begin),
+                    sizeof(T) * (end - begin));
+      }
+    } else {
+      move_if_noexcept(begin, end, dest);
+      destroy_elements(begin, end);
     }
   }
 
-  void shrink_to_fit() {
-    if (!small_) {
-      if (size_ <= SMALL_SIZE) {
-        buffer temp = buffer_;
-        buffer_.~buffer();
-        try {
-          copy(temp.data(), temp.data() + size_, static_buffer_.begin());
-        } catch (...) {
-          new (&buffer_) buffer(temp);
-          throw;
-        }
-        if (temp.unique()) {
-          destroy_elements(temp.data(), temp.data() + size_);
-        }
-        small_ = true;
-      } else if (size_ != buffer_.capacity()) {
-        new (&buffer_) buffer(realloc(size_, cbegin(), cend()));
+  // Relocates [begin, end) to `dest`, leaving `count` uninitialized slots
+  // starting at `index`.
+  void relocate_around(iterator begin, iterator end, size_t index,
+                       size_t count, iterator dest) {
+    if constexpr (socow_is_trivially_relocatable<T>::value) {
+      relocate(begin, begin + index, dest);
+      relocate(begin + index, end, dest + index + count);
+    } else {
+      move_if_noexcept(begin, begin + index, dest);
+      try {
+        move_if_noexcept(begin + index, end, dest + index + count);
+      } catch (...) {
+        destroy_elements(dest, dest + index);
+        throw;
       }
+      destroy_elements(begin, end);
     }
   }
 
-  void clear() {
-    if (small_ || buffer_.unique()) {
-      destroy_elements(begin(), end());
-    } else {
-      size_t cap = buffer_.capacity();
-      destroy_buffer();
-      new (&buffer_) buffer(cap);
+  static void destroy_elements(iterator begin, iterator end) {
+    if constexpr (socow_is_thread_independent<T>::value &&
+                  !std::is_trivially_destructible_v<T>) {
+      size_t n = end - begin;
+      if (socow_executor* executor =
+              socow_parallel::executor_for(sizeof(T) * n)) {
+        struct {
+          iterator begin;
+          size_t n, chunks;
+        } job{begin, n, std::max<size_t>(1, executor->concurrency())};
+        // Captures a single pointer, so that making the std::function does
+        // not allocate.
+        executor->run(job.chunks, [job = &job](size_t c) {
+          std::destroy(job->begin + job->n * c / job->chunks,
+                       job->begin + job->n * (c + 1) / job->chunks);
+        });
+        return;
+      }
     }
-    size_ = 0;
+    std::destroy(begin, end);
   }
 
-  void swap(socow_vector& other) {
-    using std::swap;
+  void destroy_buffer() noexcept {
+    if (!small_) {
+      buffer_.release(size_);
+      buffer_.~buffer();
+    }
+  }
+
+  // Swaps everything but the allocators. The buffers carry their own
+  // allocators, so they can always be exchanged.
+  void swap_storage(socow_vector& other) {
     if (small_ && other.small_) {
+      swap_small(other);
+    } else if (!small_ && !other.small_) {
+      buffer_.swap(other.buffer_);
+    } else if (small_ && !other.small_) {
+      swap_small_big(*this, other);
+    } else {
+      swap_small_big(other, *this);
+    }
+    size_t size = size_;
+    size_ = other.size_;
+    other.size_ = size;
+    bool small = small_;
+    small_ = other.small_;
+    other.small_ = small;
+  }
+
+  // Copies the whole small storage of `other`, constructed or not. Only
+  // called when COPY_SMALL_BLOCK, and left empty for other element types.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+// The slots past `size_` are copied without being read as elements.
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+  void copy_small_block(socow_vector const& other) noexcept {
+    if constexpr (COPY_SMALL_BLOCK) {
+      std::memcpy(&static_buffer_, &other.static_buffer_,
+                  sizeof(static_buffer_));
+    }
+  }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+  void swap_small(socow_vector& other) {
+    if constexpr (COPY_SMALL_BLOCK) {
+      alignas(T) unsigned char temp[sizeof(static_buffer_)];
+      size_t bytes = sizeof(T) * std::max<size_t>(size_, other.size_);
+      std::memcpy(temp, &static_buffer_, bytes);
+      std::memcpy(&static_buffer_, &other.static_buffer_, bytes);
+      std::memcpy(&other.static_buffer_, temp, bytes);
+    } else {
+      using std::swap;
       for (size_t i = 0; i < std::min(size_, other.size_); i++) {
         swap(static_buffer_[i], other.static_buffer_[i]);
       }
       if (size_ < other.size_) {
-        copy(other.static_buffer_.begin() + size_,
+        move(other.static_buffer_.begin() + size_,
              other.static_buffer_.begin() + other.size_,
              static_buffer_.begin() + size_);
         destroy_elements(other.static_buffer_.begin() + size_,
                          other.static_buffer_.begin() + other.size_);
       } else {
-        copy(static_buffer_.begin() + other.size_,
+        move(static_buffer_.begin() + other.size_,
              static_buffer_.begin() + size_,
              other.static_buffer_.begin() + other.size_);
         destroy_elements(static_buffer_.begin() + other.size_,
                          static_buffer_.begin() + size_);
       }
-    } else if (!small_ && !other.small_) {
-      swap(other.buffer_, buffer_);
-    } else if (small_ && !other.small_) {
-      swap_small_big(*this, other);
-    } else {
-      swap_small_big(other, *this);
     }
-    swap(other.size_, size_);
-    swap(small_, other.small_);
-  }
-
-  iterator begin() {
-    return data();
-  }
-
-  iterator end() {
-    return data() + size_;
   }
 
-  const_iterator begin() const {
-    return cbegin();
-  }
-
-  const_iterator end() const {
-    return cend();
-  }
-
-  iterator insert(const_iterator pos, T const& value) {
-    size_t index = pos - cbegin();
-    push_back(value);
-    iterator iter = begin() + index;
-    using std::swap;
-    for (iterator i = end() - 1; i != iter; i--) {
-      swap(*i, *(i - 1));
+  void swap_small_big(socow_vector& small, socow_vector& big) {
+    buffer temp(std::move(big.buffer_));
+    big.buffer_.~buffer();
+    try {
+      relocate(small.static_buffer_.begin(),
+               small.static_buffer_.begin() + small.size_,
+               big.static_buffer_.begin());
+    } catch (...) {
+      new (&big.buffer_) buffer(std::move(temp));
+      throw;
     }
-    return iter;
-  }
-
-  iterator erase(const_iterator pos) {
-    return erase(pos, pos + 1);
+    new (&small.buffer_) buffer(std::move(temp));
   }
 
-  iterator erase(const_iterator first, const_iterator last) {
-    size_t index1 = first - cbegin();
-    size_t index2 = last - cbegin();
-    size_t to = cend() - last;
-    using std::swap;
-    for (size_t i = 0; i < to; i++) {
-      swap(data()[i + index1], data()[i + index2]);
-    }
-    for (int i = 0; i < index2 - index1; i++) {
-      pop_back();
+  // Whether `other` holds memory that the allocator of this vector can free.
+  bool same_allocator(socow_vector const& other) const {
+    if constexpr (alloc_traits::is_always_equal::value) {
+      return true;
+    } else {
+      return allocator() == other.allocator();
     }
-    return begin() + index1;
   }
 
-private:
-  struct buffer {
-    buffer() : buffer_data_(nullptr) {}
-
-    explicit buffer(size_t capacity)
-        : buffer_data_(static_cast<buffer_data*>(operator new(
-              sizeof(buffer_data) + sizeof(T) * capacity))) {
-      buffer_data_->links = 1;
-      buffer_data_->capacity_ = capacity;
-    }
-
-    buffer(buffer const& other) : buffer_data_(other.buffer_data_) {
-      buffer_data_->links++;
-    }
-
-    buffer& operator=(buffer const& other) {
-      if (&other != this) {
-        buffer temp(other);
-        using std::swap;
-        swap(temp.buffer_data_, this->buffer_data_);
-      }
-      return *this;
+  // Destroys the contents and leaves the vector small and empty.
+  void reset() noexcept {
+    if (small_) {
+      destroy_elements(begin(), end());
+    } else {
+      destroy_buffer();
+      small_ = true;
     }
+    size_ = 0;
+  }
 
-    ~buffer() {
-      if (unique()) {
-        operator delete(buffer_data_);
+  // Takes over the contents of `other`, which must not own anything that
+  // `*this` still refers to. A big vector hands over its buffer without
+  // touching the reference counter, a small one move-constructs its elements.
+  // Either way `other` is left small and empty.
+  void steal(socow_vector& other) noexcept(
+      std::is_nothrow_move_constructible_v<T>) {
+    if (other.small_) {
+      if constexpr (COPY_SMALL_BLOCK) {
+        copy_small_block(other);
       } else {
-        buffer_data_->links--;
+        move(other.static_buffer_.begin(),
+             other.static_buffer_.begin() + other.size_,
+             static_buffer_.begin());
       }
+      size_ = other.size_;
+      other.reset();
+    } else {
+      new (&buffer_) buffer(std::move(other.buffer_));
+      other.buffer_.~buffer();
+      small_ = false;
+      size_ = other.size_;
+      other.small_ = true;
+      other.size_ = 0;
     }
+  }
 
-    size_t capacity() const {
-      return buffer_data_->capacity_;
-    }
+  // The small flag takes the top bit of the size, so that the object is
+  // just the size next to the storage.
+  size_t size_ : std::numeric_limits<size_t>::digits - 1;
+  size_t small_ : 1;
+  union {
+    std::array<T, SMALL_SIZE> static_buffer_;
+    buffer buffer_;
+  };
+};
 
-    T* data() {
-      return buffer_data_->data_;
-    }
+// A read-only view that holds a copy of a vector: a reference on its heap
+// buffer or a copy of its small storage. Taking it costs what copying the
+// vector does, O(SMALL_SIZE).
+template <typename Vector>
+struct socow_pinned_span {
+  using value_type = typename Vector::value_type;
+  using iterator = value_type const*;
+  using const_iterator = value_type const*;
 
-    T* data() const {
-      return buffer_data_->data_;
-    }
+  // Copies with the allocator of `vector`, so that its heap buffer is shared
+  // whatever select_on_container_copy_construction picks.
+  explicit socow_pinned_span(Vector const& vector)
+      : vector_(vector, vector.get_allocator()) {}
 
-    bool unique() {
-      return buffer_data_->links == 1;
-    }
+  value_type const& operator[](size_t i) const {
+    return vector_[i];
+  }
 
-  private:
-    struct buffer_data {
-      size_t links;
-      size_t capacity_;
-      T data_[0];
-    };
+  value_type const* data() const noexcept {
+    return vector_.cdata();
+  }
 
-    buffer_data* buffer_data_;
-  };
+  size_t size() const noexcept {
+    return vector_.size();
+  }
 
-  void make_big(size_t new_cap) {
-    buffer new_buffer = realloc(new_cap, cbegin(), cend());
-    destroy_elements(begin(), end());
-    new (&buffer_) buffer(new_buffer);
-    small_ = false;
+  bool empty() const noexcept {
+    return vector_.empty();
   }
 
-  void unshare() {
-    if (!small_ && !buffer_.unique()) {
-      new (&buffer_) buffer(realloc(buffer_.capacity(), cbegin(), cend()));
-    }
+  value_type const& front() const {
+    return vector_.front();
   }
 
-  void copy(const_iterator begin, const_iterator end, iterator dest) {
-    for (const_iterator it = begin; it < end; it++) {
-      try {
-        new (dest + (it - begin)) T(*it);
-      } catch (...) {
-        destroy_elements(dest, dest + (it - begin));
-        throw;
-      }
-    }
+  value_type const& back() const {
+    return vector_.back();
   }
 
-  buffer realloc(size_t new_capacity, const_iterator begin,
-                 const_iterator end) {
-    if (new_capacity == 0) {
-      small_ = true;
-      return buffer();
-    }
-    size_ = end - begin;
-    buffer new_buffer(new_capacity);
-    copy(begin, end, new_buffer.data());
-    if (!small_) {
-      destroy_buffer();
-    }
-    return new_buffer;
+  iterator begin() const noexcept {
+    return vector_.cbegin();
   }
 
-  static void destroy_elements(iterator begin, iterator end) {
-    for (auto it = begin; it != end; it++) {
-      it->~T();
-    }
+  iterator end() const noexcept {
+    return vector_.cend();
   }
 
-  void destroy_buffer() {
-    if (!small_) {
-      if (buffer_.unique()) {
-        destroy_elements(begin(), end());
+  // The view is valid as long as this object is.
+  operator socow_span<value_type>() const noexcept {
+    return vector_.reads();
+  }
+
+private:
+  Vector vector_;
+};
+
+// A vector holds no pointers into itself, so it can be relocated whenever
+// the elements in its small storage can.
+template <typename T, size_t SMALL_SIZE, typename RefCount, typename Allocator,
+          typename Growth>
+struct socow_is_trivially_relocatable<
+    socow_vector<T, SMALL_SIZE, RefCount, Allocator, Growth>>
+    : std::conjunction<socow_is_trivially_relocatable<T>,
+                       socow_is_trivially_relocatable<Allocator>> {};
+
+// Copies of a vector with a thread-safe reference counting policy may share
+// a buffer across threads.
+template <typename T, size_t SMALL_SIZE, typename RefCount, typename Allocator,
+          typename Growth>
+struct socow_is_thread_independent<
+    socow_vector<T, SMALL_SIZE, RefCount, Allocator, Growth>>
+    : std::conjunction<
+          std::bool_constant<RefCount::THREAD_SAFE>,
+          typename std::allocator_traits<Allocator>::is_always_equal,
+          socow_is_thread_independent<T>> {};
+
+template <typename T, size_t SMALL_SIZE, typename RefCount, typename Allocator,
+          typename Growth>
+struct socow_has_reflexive_equality<
+    socow_vector<T, SMALL_SIZE, RefCount, Allocator, Growth>>
+    : socow_has_reflexive_equality<T> {};
+
+// Hashes the elements. With a socow_memoized policy, copies sharing a heap
+// buffer compute its hash once.
+template <typename T, size_t SMALL_SIZE, typename RefCount, typename Allocator,
+          typename Growth>
+struct std::hash<socow_vector<T, SMALL_SIZE, RefCount, Allocator, Growth>> {
+  size_t operator()(socow_vector<T, SMALL_SIZE, RefCount, Allocator,
+                                 Growth> const& v) const {
+    return v.memo(&KEY, [](socow_span<T> elements) {
+      size_t seed = elements.size();
+      for (T const& e : elements) {
+        seed ^= std::hash<T>()(e) + 0x9e3779b97f4a7c15 + (seed << 6) +
+                (seed >> 2);
       }
-      buffer_.~buffer();
-    }
+      return seed;
+    });
   }
 
-  void swap_small_big(socow_vector& small, socow_vector& big) {
-    buffer temp = big.buffer_;
-    big.buffer_.~buffer();
-    try {
-      copy(small.static_buffer_.begin(),
-           small.static_buffer_.begin() + small.size_,
-           big.static_buffer_.begin());
-    } catch (...) {
-      new (&big.buffer_) buffer(temp);
-      throw;
-    }
-    destroy_elements(small.begin(), small.end());
-    new (&small.buffer_) buffer(temp);
+private:
+  static constexpr char KEY = 0;
+};
+
+// The largest SMALL_SIZE for which socow_vector<T, SMALL_SIZE, RefCount,
+// Allocator> still fits in `BYTES`, e.g. in a cache line; 0 if none does.
+template <typename T, size_t BYTES,
+          typename RefCount = socow_plain_refcount,
+          typename Allocator = socow_allocator<T>>
+struct socow_small_size_for {
+private:
+  static constexpr size_t round_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
   }
 
-  size_t size_{0};
-  bool small_{true};
-  union {
-    std::array<T, SMALL_SIZE> static_buffer_;
-    buffer buffer_;
-  };
-};
\ No newline at end of file
+  // The allocator, then the size, then the storage of at least a pointer.
+  static constexpr size_t ALLOCATOR_SIZE =
+      std::is_empty_v<Allocator> && !std::is_final_v<Allocator>
+          ? 0
+          : sizeof(Allocator);
+  static constexpr size_t STORAGE_ALIGN =
+      std::max(alignof(T), alignof(void*));
+  static constexpr size_t OBJECT_ALIGN =
+      std::max({STORAGE_ALIGN, alignof(size_t), alignof(Allocator)});
+  static constexpr size_t STORAGE_OFFSET = round_up(
+      round_up(ALLOCATOR_SIZE, alignof(size_t)) + sizeof(size_t),
+      STORAGE_ALIGN);
+  static constexpr size_t LIMIT = BYTES / OBJECT_ALIGN * OBJECT_ALIGN;
+
+public:
+  static constexpr size_t value =
+      LIMIT < STORAGE_OFFSET + sizeof(void*)
+          ? 0
+          : (LIMIT - STORAGE_OFFSET) / sizeof(T);
+
+  static_assert(value == 0 ||
+                sizeof(socow_vector<T, value, RefCount, Allocator>) <= BYTES);
+  static_assert(sizeof(socow_vector<T, value + 1, RefCount, Allocator>) >
+                BYTES);
+};
+
+template <typename T, size_t BYTES,
+          typename RefCount = socow_plain_refcount,
+          typename Allocator = socow_allocator<T>>
+inline constexpr size_t socow_small_size_for_v =
+    socow_small_size_for<T, BYTES, RefCount, Allocator>::value;
+
+// A vector is its size next to its storage, with no room for anything else.
+static_assert(sizeof(socow_vector<void*, 1>) == 2 * sizeof(void*));
+static_assert(sizeof(socow_vector<size_t, 3>) == 4 * sizeof(size_t));
+static_assert(sizeof(socow_vector<uint32_t, 2>) ==
+              sizeof(size_t) + std::max(sizeof(void*), size_t{8}));
+static_assert(sizeof(socow_vector<char, sizeof(void*)>) ==
+              sizeof(size_t) + sizeof(void*));
+static_assert(socow_small_size_for_v<int, 64> ==
+              (64 - sizeof(size_t)) / sizeof(int));
+
+#if __has_include(<memory_resource>)
+// Takes the buffers from a std::pmr::memory_resource, e.g. a per-request
+// std::pmr::monotonic_buffer_resource.
+template <typename T, size_t SMALL_SIZE,
+          typename RefCount = socow_plain_refcount,
+          typename Growth = socow_growth_2x<>>
+using socow_pmr_vector =
+    socow_vector<T, SMALL_SIZE, RefCount, std::pmr::polymorphic_allocator<T>,
+                 Growth>;
+#endif
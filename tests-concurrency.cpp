@@ -0,0 +1,469 @@
+#include <atomic>
+#include <mutex>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "socow-pool.h"
+#include "socow-reclaimer.h"
+#include "socow-thread-pool.h"
+#include "socow-vector.h"
+
+template struct socow_vector<int, 2, socow_atomic_refcount>;
+
+namespace {
+
+struct counted {
+    counted(size_t val) : val(val) {
+        ++instances;
+    }
+
+    counted(counted const& other) : val(other.val) {
+        if (val == POISON)
+            throw std::runtime_error("poisoned copy");
+        ++instances;
+    }
+
+    ~counted() {
+        --instances;
+    }
+
+    counted& operator=(counted const&) = default;
+
+    size_t val;
+    static std::atomic<size_t> instances;
+    static constexpr size_t POISON = size_t(-1);
+};
+
+std::atomic<size_t> counted::instances{0};
+
+} // namespace
+
+// Its instance counter is atomic.
+template <>
+struct socow_is_thread_independent<counted> : std::true_type {};
+
+namespace {
+struct gated;
+} // namespace
+
+template <>
+struct socow_is_thread_independent<gated> : std::true_type {};
+
+namespace {
+
+// Fills a thread_local vector made before the pool cache of its thread, so
+// that it is destroyed after the cache at thread exit.
+void fill_thread_local_vector() {
+    thread_local socow_vector<int, 2, socow_plain_refcount,
+                              socow_pool_allocator<int>>
+        v;
+    for (int i = 0; i != 100; ++i)
+        v.push_back(i);
+}
+
+// Destroys its elements on the reclaimer thread only once opened.
+struct gated {
+    ~gated() {
+        while (!open)
+            std::this_thread::yield();
+    }
+
+    static std::atomic<bool> open;
+};
+
+std::atomic<bool> gated::open{true};
+
+// Defers every heap buffer to `reclaimer` while alive.
+struct deferred_scope {
+    explicit deferred_scope(socow_reclaimer& reclaimer) {
+        socow_deferred::set(&reclaimer, 1);
+    }
+
+    ~deferred_scope() {
+        socow_deferred::set(nullptr);
+    }
+};
+
+// Runs every task on the calling thread and counts the jobs.
+struct counting_executor : socow_executor {
+    size_t concurrency() const noexcept override {
+        return 4;
+    }
+
+    void run(size_t count,
+             std::function<void(size_t)> const& task) noexcept override {
+        ++jobs;
+        for (size_t i = 0; i != count; ++i)
+            task(i);
+    }
+
+    size_t jobs = 0;
+};
+
+// Sends every copy and destruction through `executor` while alive.
+struct parallel_scope {
+    explicit parallel_scope(socow_executor& executor, size_t threshold = 1) {
+        socow_parallel::set(&executor, threshold);
+    }
+
+    ~parallel_scope() {
+        socow_parallel::set(nullptr);
+    }
+};
+
+size_t const THREADS = 8;
+
+} // namespace
+
+TEST(concurrency, copy_and_mutate_shared) {
+    using vector = socow_vector<std::string, 2, socow_atomic_refcount>;
+    size_t const N = 1000, ITERATIONS = 200;
+
+    vector source;
+    for (size_t i = 0; i != N; ++i)
+        source.push_back(std::to_string(i));
+    vector const& snapshot = source;
+
+    std::atomic<size_t> errors{0};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t != THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            for (size_t it = 0; it != ITERATIONS; ++it) {
+                vector copy = snapshot;
+                vector other = copy;
+                if ((it + t) % 2 == 0)
+                    copy[it % N] = "changed";
+                if (copy.cdata()[N - 1] != std::to_string(N - 1) ||
+                    other.cdata()[it % N] != std::to_string(it % N))
+                    ++errors;
+                copy.push_back("tail");
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(0, errors.load());
+    for (size_t i = 0; i != N; ++i)
+        EXPECT_EQ(std::to_string(i), snapshot.cdata()[i]);
+}
+
+TEST(concurrency, last_owner_destroys) {
+    using vector = socow_vector<counted, 2, socow_atomic_refcount>;
+    size_t const N = 100, ROUNDS = 500;
+    {
+        std::mutex mutex;
+        std::vector<vector> handed_over;
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t != THREADS; ++t) {
+            threads.emplace_back([&, t] {
+                for (size_t round = 0; round != ROUNDS; ++round) {
+                    vector local;
+                    for (size_t i = 0; i != N; ++i)
+                        local.emplace_back(i + t);
+                    vector copy = local;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        handed_over.push_back(std::move(copy));
+                        if (handed_over.size() > THREADS)
+                            handed_over.erase(handed_over.begin());
+                    }
+                    if (round % 3 == 0)
+                        local.pop_back();
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+    EXPECT_EQ(0, counted::instances.load());
+}
+
+TEST(concurrency, pool_across_threads) {
+    using vector = socow_vector<counted, 2, socow_atomic_refcount,
+                                socow_pool_allocator<counted>>;
+    size_t const ROUNDS = 300;
+    {
+        std::mutex mutex;
+        std::vector<vector> handed_over;
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t != THREADS; ++t) {
+            threads.emplace_back([&, t] {
+                for (size_t round = 0; round != ROUNDS; ++round) {
+                    vector local;
+                    for (size_t i = 0; i != round % 200; ++i)
+                        local.emplace_back(i + t);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    handed_over.push_back(local);
+                    if (handed_over.size() > THREADS)
+                        handed_over.erase(handed_over.begin());
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+    EXPECT_EQ(0, counted::instances.load());
+
+    socow_pool& pool = socow_pool::instance();
+    EXPECT_LT(0, pool.stats().hits);
+    pool.trim();
+    EXPECT_EQ(0, pool.stats().bytes_cached);
+}
+
+TEST(concurrency, pool_freed_into_after_thread_cache) {
+    std::thread(fill_thread_local_vector).join();
+    socow_pool& pool = socow_pool::instance();
+    pool.trim();
+    EXPECT_EQ(0, pool.stats().bytes_cached);
+}
+
+TEST(concurrency, snapshot_fan_out) {
+    using vector = socow_vector<counted, 2>;
+    size_t const N = 1000, ROUNDS = 200;
+    {
+        socow_snapshot<counted> snapshot;
+        {
+            vector source;
+            for (size_t i = 0; i != N; ++i)
+                source.emplace_back(i);
+            counted const* elements = source.cdata();
+            snapshot = source.freeze();
+            EXPECT_EQ(elements, snapshot.data());
+            EXPECT_TRUE(source.empty());
+        }
+
+        std::atomic<size_t> errors{0};
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t != THREADS; ++t) {
+            threads.emplace_back([&, copy = snapshot] {
+                for (size_t round = 0; round != ROUNDS; ++round) {
+                    socow_snapshot<counted> local = copy;
+                    if (local[round % N].val != round % N)
+                        ++errors;
+                    vector thawed(local);
+                    thawed.emplace_back(N);
+                    if (thawed.size() != N + 1 || thawed[0].val != 0)
+                        ++errors;
+                }
+            });
+        }
+        snapshot = socow_snapshot<counted>();
+        for (std::thread& thread : threads)
+            thread.join();
+        EXPECT_EQ(0, errors.load());
+    }
+    EXPECT_EQ(0, counted::instances.load());
+}
+
+TEST(concurrency, snapshot_shared_by_atomic_vectors) {
+    using vector = socow_vector<counted, 2, socow_atomic_refcount>;
+    size_t const N = 100, ROUNDS = 200;
+    {
+        vector source;
+        for (size_t i = 0; i != N; ++i)
+            source.emplace_back(i);
+        vector other = source;
+        socow_snapshot<counted> snapshot = source.freeze();
+        EXPECT_EQ(other.cdata(), snapshot.data());
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t != THREADS; ++t) {
+            threads.emplace_back([&snapshot] {
+                for (size_t round = 0; round != ROUNDS; ++round) {
+                    vector thawed(snapshot);
+                    EXPECT_EQ(snapshot.data(), thawed.cdata());
+                    thawed[round % N] = counted(0);
+                    EXPECT_NE(snapshot.data(), thawed.cdata());
+                }
+            });
+        }
+        other.pop_back();
+        for (std::thread& thread : threads)
+            thread.join();
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(i, snapshot[i].val);
+    }
+    EXPECT_EQ(0, counted::instances.load());
+}
+
+TEST(concurrency, memo_shared_across_threads) {
+    using vector =
+        socow_vector<int, 2, socow_memoized<socow_atomic_refcount>>;
+    size_t const N = 1000, ROUNDS = 200;
+
+    vector source;
+    for (size_t i = 0; i != N; ++i)
+        source.push_back(static_cast<int>(i));
+    size_t const expected = std::hash<vector>()(vector(source));
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t != THREADS; ++t) {
+        threads.emplace_back([&source, expected] {
+            for (size_t round = 0; round != ROUNDS; ++round) {
+                vector copy = source;
+                EXPECT_EQ(expected, std::hash<vector>()(copy));
+                copy[round % N] = -1;
+                EXPECT_NE(expected, std::hash<vector>()(copy));
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+TEST(concurrency, parallel_unshare) {
+    using vector = socow_vector<std::string, 2, socow_atomic_refcount>;
+    size_t const N = 10000;
+    socow_thread_pool pool(4);
+    parallel_scope scope(pool);
+
+    vector source;
+    for (size_t i = 0; i != N; ++i)
+        source.push_back(std::to_string(i));
+    vector copy = source;
+    copy[0] = "changed";
+
+    EXPECT_NE(source.cdata(), copy.cdata());
+    EXPECT_EQ("0", source.cdata()[0]);
+    for (size_t i = 1; i != N; ++i)
+        EXPECT_EQ(source.cdata()[i], copy.cdata()[i]);
+}
+
+TEST(concurrency, parallel_copy_throws) {
+    using vector = socow_vector<counted, 2, socow_atomic_refcount>;
+    size_t const N = 1000;
+    socow_thread_pool pool(4);
+    parallel_scope scope(pool);
+    {
+        vector source;
+        source.reserve(N);
+        for (size_t i = 0; i != N; ++i)
+            source.emplace_back(i == N / 2 + 1 ? counted::POISON : i);
+        vector copy = source;
+        EXPECT_THROW(copy[0].val = 1, std::runtime_error);
+        EXPECT_EQ(N, counted::instances);
+        EXPECT_EQ(source.cdata(), copy.cdata());
+        EXPECT_EQ(0, copy.cdata()[0].val);
+    }
+    EXPECT_EQ(0, counted::instances);
+}
+
+TEST(concurrency, parallel_only_thread_independent) {
+    using plain = socow_vector<int, 1>;
+    using atomic = socow_vector<int, 1, socow_atomic_refcount>;
+    counting_executor executor;
+    // Only the buffers of 100 vectors reach the threshold.
+    parallel_scope scope(executor, 100 * sizeof(plain));
+    {
+        // Copies of the elements share one plain reference counter.
+        socow_vector<plain, 1> a(100, plain{1, 2, 3});
+        socow_vector<plain, 1> b = a;
+        b[0].push_back(4);
+        EXPECT_EQ(4, b.cdata()[0].size());
+    }
+    EXPECT_EQ(0, executor.jobs);
+    {
+        socow_vector<atomic, 1> a(100, atomic{1, 2, 3});
+        socow_vector<atomic, 1> b = a;
+        b[0].push_back(4);
+        EXPECT_EQ(1, executor.jobs);
+    }
+    EXPECT_EQ(3, executor.jobs);
+}
+
+TEST(concurrency, parallel_destroy) {
+    using vector = socow_vector<counted, 2, socow_atomic_refcount>;
+    size_t const N = 1000;
+    socow_thread_pool pool(3);
+    parallel_scope scope(pool);
+    {
+        vector v;
+        for (size_t i = 0; i != N; ++i)
+            v.push_back(i);
+        EXPECT_EQ(N, counted::instances);
+    }
+    EXPECT_EQ(0, counted::instances);
+}
+
+TEST(concurrency, deferred_destruction) {
+    using vector = socow_vector<counted, 2, socow_atomic_refcount>;
+    size_t const N = 1000;
+    socow_background_reclaimer reclaimer;
+    {
+        deferred_scope scope(reclaimer);
+        vector v;
+        for (size_t i = 0; i != N; ++i)
+            v.push_back(i);
+        size_t grown = reclaimer.deferred();
+        {
+            vector copy = v;
+        }
+        EXPECT_EQ(grown, reclaimer.deferred());
+        vector small;
+        small.push_back(0);
+    }
+    reclaimer.drain();
+    EXPECT_EQ(0, counted::instances);
+    EXPECT_EQ(0, reclaimer.depth());
+    EXPECT_EQ(reclaimer.deferred(), reclaimer.reclaimed());
+}
+
+TEST(concurrency, deferred_only_when_safe) {
+    socow_background_reclaimer reclaimer;
+    deferred_scope scope(reclaimer);
+    {
+        // Copies of the elements would share a plain reference counter.
+        using plain = socow_vector<int, 2>;
+        socow_vector<plain, 1> v(100, plain{1, 2});
+    }
+#if __has_include(<memory_resource>)
+    {
+        // The memory resource may be gone by the time the buffer is freed.
+        std::pmr::monotonic_buffer_resource resource;
+        socow_pmr_vector<int, 2> v(&resource);
+        for (int i = 0; i != 100; ++i)
+            v.push_back(i);
+    }
+#endif
+    EXPECT_EQ(0, reclaimer.deferred());
+    {
+        socow_vector<int, 2> v;
+        for (int i = 0; i != 100; ++i)
+            v.push_back(i);
+    }
+    reclaimer.drain();
+    EXPECT_LT(0, reclaimer.deferred());
+}
+
+TEST(concurrency, deferred_queue_depth) {
+    using gated_vector = socow_vector<gated, 2, socow_atomic_refcount>;
+    using counted_vector = socow_vector<counted, 2, socow_atomic_refcount>;
+    socow_background_reclaimer reclaimer(2);
+    deferred_scope scope(reclaimer);
+
+    {
+        gated_vector a(3, gated()), b(3, gated());
+        gated::open = false;
+    }
+    EXPECT_EQ(2, reclaimer.depth());
+    {
+        counted_vector v(3, counted(0));
+    }
+    EXPECT_EQ(0, counted::instances);
+    EXPECT_EQ(2, reclaimer.depth());
+    EXPECT_EQ(2, reclaimer.deferred());
+
+    gated::open = true;
+    reclaimer.drain();
+    EXPECT_EQ(0, reclaimer.depth());
+    EXPECT_EQ(2, reclaimer.peak_depth());
+    EXPECT_EQ(2, reclaimer.reclaimed());
+}
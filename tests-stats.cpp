@@ -0,0 +1,87 @@
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "socow-vector.h"
+
+namespace {
+
+// Every test uses vectors of its own element type, so that its counters
+// start at zero.
+template <size_t TAG>
+struct tagged {
+    tagged(size_t val) : val(val) {}
+
+    size_t val;
+};
+
+// Made before any counters, so it frees its buffer at exit after the
+// function-local statics are destroyed.
+socow_vector<tagged<3>, 2> static_vector;
+
+} // namespace
+
+TEST(stats, allocations_and_transitions) {
+    using vector = socow_vector<tagged<0>, 2>;
+    {
+        vector a;
+        for (size_t i = 0; i != 3; ++i)
+            a.push_back(i);
+        a.pop_back();
+        a.shrink_to_fit();
+    }
+    socow_counters const& stats = vector::stats();
+    EXPECT_EQ(1, stats.get(socow_event::allocation));
+    EXPECT_EQ(1, stats.get(socow_event::free));
+    EXPECT_EQ(1, stats.get(socow_event::small_to_big));
+    EXPECT_EQ(1, stats.get(socow_event::big_to_small));
+    EXPECT_EQ(2 * sizeof(tagged<0>), stats.get(socow_event::move_bytes));
+    EXPECT_EQ(0, stats.get(socow_event::unshare));
+}
+
+TEST(stats, unshares) {
+    using vector = socow_vector<tagged<1>, 2>;
+    {
+        vector a;
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i);
+        vector b = a;
+        vector c = a;
+        EXPECT_EQ(3, vector::stats().refcount_peak.load());
+
+        b.data();
+        c.pop_back();
+        b.erase(b.begin(), b.begin() + 5);
+    }
+    socow_counters const& stats = vector::stats();
+    EXPECT_EQ(2, stats.get(socow_event::unshare));
+    EXPECT_EQ(19 * sizeof(tagged<1>), stats.get(socow_event::unshare_bytes));
+    EXPECT_EQ(stats.get(socow_event::allocation),
+              stats.get(socow_event::free));
+}
+
+TEST(stats, dump) {
+    using vector = socow_vector<tagged<2>, 1>;
+    {
+        vector a;
+        a.push_back(1);
+        a.push_back(2);
+    }
+    std::ostringstream text;
+    socow_stats_registry::instance().dump_text(text);
+    EXPECT_NE(std::string::npos, text.str().find("tagged<2"));
+    EXPECT_NE(std::string::npos, text.str().find("small_to_big=1"));
+
+    std::ostringstream json;
+    socow_stats_registry::instance().dump_json(json);
+    EXPECT_EQ('[', json.str().front());
+    EXPECT_NE(std::string::npos, json.str().find("\"allocations\":1"));
+    EXPECT_NE(std::string::npos, json.str().find("\"refcount_peak\":"));
+}
+
+TEST(stats, static_vector) {
+    for (size_t i = 0; i != 3; ++i)
+        static_vector.push_back(i);
+    EXPECT_EQ(1, static_vector.stats().get(socow_event::allocation));
+}
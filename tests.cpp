@@ -1,10 +1,31 @@
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <string>
 #include <unordered_set>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#include <vector>
+#ifdef __unix__
+#include <unistd.h>
+#endif
 
 #include "gtest/gtest.h"
 
+#include "socow-chunked-vector.h"
+#ifdef __linux__
+#include "socow-mmap.h"
+#endif
+#include "socow-pool.h"
+#include "socow-serialize.h"
 #include "socow-vector.h"
 
 template struct socow_vector<int, 2>;
+template struct socow_vector<std::string, 3>;
 
 template <typename T>
 T const& as_const(T& obj) {
@@ -127,6 +148,117 @@ size_t element<T>::copy_counter = 0;
 
 using container = socow_vector<element<size_t>, 2>;
 
+struct relocatable {
+    relocatable(size_t val) : val(val) {}
+
+    relocatable(relocatable const& other) : val(other.val) {
+        ++constructions;
+    }
+
+    relocatable(relocatable&& other) noexcept : val(other.val) {
+        ++constructions;
+    }
+
+    size_t val;
+    static size_t constructions;
+};
+
+size_t relocatable::constructions = 0;
+
+template <>
+struct socow_is_trivially_relocatable<relocatable> : std::true_type {};
+
+struct allocation_stats {
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t live_bytes = 0;
+};
+
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+
+    explicit counting_allocator(allocation_stats* stats) : stats(stats) {}
+
+    template <typename U>
+    counting_allocator(counting_allocator<U> const& other)
+        : stats(other.stats) {}
+
+    T* allocate(size_t n) {
+        ++stats->allocations;
+        stats->live_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        ++stats->deallocations;
+        stats->live_bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(counting_allocator<U> const& other) const {
+        return stats == other.stats;
+    }
+
+    template <typename U>
+    bool operator!=(counting_allocator<U> const& other) const {
+        return stats != other.stats;
+    }
+
+    allocation_stats* stats;
+};
+
+// Rounds allocations up to powers of two and reports it, like a malloc with
+// power-of-two size classes.
+template <typename T>
+struct rounding_allocator : counting_allocator<T> {
+    explicit rounding_allocator(allocation_stats* stats)
+        : counting_allocator<T>(stats) {}
+
+    template <typename U>
+    rounding_allocator(rounding_allocator<U> const& other)
+        : counting_allocator<T>(other) {}
+
+    socow_allocation_result<T*> allocate_at_least(size_t n) {
+        size_t bytes = 1;
+        while (bytes < n * sizeof(T))
+            bytes *= 2;
+        size_t count = std::max(n, bytes / sizeof(T));
+        return {this->allocate(count), count};
+    }
+};
+
+// Hands out exactly what is asked for, so that capacities are predictable.
+template <typename T>
+struct exact_allocator {
+    using value_type = T;
+
+    exact_allocator() = default;
+
+    template <typename U>
+    exact_allocator(exact_allocator<U> const&) {}
+
+    T* allocate(size_t n) {
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(exact_allocator<U> const&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(exact_allocator<U> const&) const {
+        return false;
+    }
+};
+
 TEST(correctness, default_ctor) {
     container a;
     element<size_t>::expect_no_instances();
@@ -163,6 +295,50 @@ TEST(correctness, push_back_from_self) {
     element<size_t>::expect_no_instances();
 }
 
+TEST(correctness, emplace_back) {
+    size_t const N = 500;
+    {
+        container a;
+        a.reserve(N);
+        element<size_t>::set_copy_counter(0);
+        for (size_t i = 0; i != N; ++i) {
+            element<size_t>& e = a.emplace_back(i);
+            EXPECT_EQ(&e, &as_const(a).back());
+        }
+        EXPECT_EQ(0, element<size_t>::get_copy_counter());
+
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(i, a[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, emplace_back_from_self) {
+    size_t const N = 500;
+    {
+        container a;
+        a.emplace_back(42);
+        for (size_t i = 0; i != N; ++i)
+            a.emplace_back(as_const(a)[0]);
+
+        for (size_t i = 0; i != a.size(); ++i)
+            EXPECT_EQ(42, a[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, push_back_rvalue) {
+    socow_vector<std::string, 2> a;
+    std::string s(100, 'x');
+    char const* old_data = s.data();
+    for (size_t i = 0; i != 3; ++i)
+        a.push_back(std::string(100, 'a' + i));
+    a.push_back(std::move(s));
+    EXPECT_EQ(4, a.size());
+    EXPECT_EQ(old_data, a.cdata()[3].data());
+    EXPECT_EQ(std::string(100, 'c'), a.cdata()[2]);
+}
+
 TEST(correctness, subscription) {
     size_t const N = 500;
     socow_vector<size_t, 2> a;
@@ -316,6 +492,19 @@ TEST(correctness, reserve_2) {
     element<size_t>::expect_no_instances();
 }
 
+TEST(correctness, reserve_single_user) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i + 100);
+
+    a.reserve(100);
+    EXPECT_GE(a.capacity(), 100);
+    uintptr_t old_data = reinterpret_cast<uintptr_t>(as_const(a).data());
+    for (size_t i = 10; i != 100; ++i)
+        a.push_back(i + 100);
+    EXPECT_EQ(old_data, reinterpret_cast<uintptr_t>(as_const(a).data()));
+}
+
 TEST(correctness, superfluous_reserve) {
     size_t const N = 500, K = 100;
     {
@@ -355,6 +544,203 @@ TEST(correctness, clear_2) {
     element<size_t>::expect_no_instances();
 }
 
+TEST(correctness, resize) {
+    {
+        container a;
+        a.resize(3);
+        a.resize(6, 7);
+        ASSERT_EQ(6, a.size());
+        for (size_t i = 3; i != 6; ++i)
+            EXPECT_EQ(7, as_const(a)[i]);
+
+        a.resize(2);
+        EXPECT_EQ(2, a.size());
+        a.resize(5, as_const(a)[0]);
+        for (size_t i = 2; i != 5; ++i)
+            EXPECT_EQ(as_const(a)[0], as_const(a)[i]);
+    }
+    element<size_t>::expect_no_instances();
+
+    socow_vector<size_t, 2> b;
+    b.push_back(5);
+    b.resize(4);
+    size_t expected[] = {5, 0, 0, 0};
+    for (size_t i = 0; i != 4; ++i)
+        EXPECT_EQ(expected[i], as_const(b)[i]);
+}
+
+TEST(correctness, resize_from_own_element) {
+    {
+        container a;
+        for (size_t i = 0; i != 4; ++i)
+            a.push_back(i + 100);
+        a.shrink_to_fit();
+        a.resize(10, as_const(a)[3]);
+        ASSERT_EQ(10, a.size());
+        for (size_t i = 3; i != 10; ++i)
+            EXPECT_EQ(103, as_const(a)[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, resize_default_init) {
+    socow_vector<int, 2> a;
+    a.push_back(1);
+    a.resize_default_init(100);
+    ASSERT_EQ(100, a.size());
+    EXPECT_EQ(1, as_const(a)[0]);
+    for (int i = 0; i != 100; ++i)
+        a[i] = i;
+    a.resize_default_init(50);
+    ASSERT_EQ(50, a.size());
+    EXPECT_EQ(49, as_const(a)[49]);
+}
+
+TEST(correctness, resize_zero_filled) {
+    socow_vector<double, 2> a;
+    a.push_back(1.5);
+    a.resize(1 << 16);
+    ASSERT_EQ(1 << 16, a.size());
+    EXPECT_EQ(1.5, as_const(a)[0]);
+    for (size_t i = 1; i != a.size(); ++i)
+        ASSERT_EQ(0.0, as_const(a)[i]);
+
+    socow_vector<double, 2> b = a;
+    b[0] = 2.5;
+    b.resize(1 << 17);
+    EXPECT_EQ(1.5, as_const(a)[0]);
+    EXPECT_EQ(2.5, as_const(b)[0]);
+    for (size_t i = 1; i != b.size(); ++i)
+        ASSERT_EQ(0.0, as_const(b)[i]);
+}
+
+TEST(correctness, resize_throw) {
+    {
+        container a;
+        a.reserve(10);
+        for (size_t i = 0; i != 4; ++i)
+            a.push_back(i);
+
+        element<size_t>::set_throw_countdown(3);
+        EXPECT_THROW(a.resize(8, 42), std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+        EXPECT_EQ(4, a.size());
+
+        element<size_t>::set_throw_countdown(3);
+        EXPECT_THROW(a.resize(20, 42), std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+        ASSERT_EQ(4, a.size());
+        for (size_t i = 0; i != 4; ++i)
+            EXPECT_EQ(i, as_const(a)[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, range_ctor) {
+    {
+        std::list<size_t> values = {1, 2, 3, 4, 5};
+        container a(values.begin(), values.end());
+        ASSERT_EQ(5, a.size());
+        for (size_t i = 0; i != 5; ++i)
+            EXPECT_EQ(i + 1, as_const(a)[i]);
+
+        container b(values.begin(), std::next(values.begin(), 2));
+        ASSERT_EQ(2, b.size());
+        EXPECT_EQ(2, b.capacity());
+        EXPECT_EQ(2, as_const(b)[1]);
+    }
+    element<size_t>::expect_no_instances();
+
+    std::istringstream in("1 2 3");
+    socow_vector<int, 2> c(std::istream_iterator<int>(in),
+                           std::istream_iterator<int>{});
+    ASSERT_EQ(3, c.size());
+    EXPECT_EQ(3, as_const(c)[2]);
+}
+
+TEST(correctness, count_ctor) {
+    {
+        container a(4, 7);
+        ASSERT_EQ(4, a.size());
+        for (size_t i = 0; i != 4; ++i)
+            EXPECT_EQ(7, as_const(a)[i]);
+        container b(0, 7);
+        EXPECT_TRUE(b.empty());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, initializer_list_ctor) {
+    socow_vector<size_t, 3> a = {1, 2};
+    socow_vector<size_t, 3> b = {1, 2, 3, 4, 5};
+    ASSERT_EQ(2, a.size());
+    ASSERT_EQ(5, b.size());
+    for (size_t i = 0; i != 5; ++i)
+        EXPECT_EQ(i + 1, as_const(b)[i]);
+    b = {6};
+    ASSERT_EQ(1, b.size());
+    EXPECT_EQ(6, as_const(b)[0]);
+}
+
+TEST(correctness, assign_reuses_buffer) {
+    {
+        container a;
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i);
+        element<size_t> const* old_data = as_const(a).data();
+        size_t c = a.capacity();
+
+        std::vector<size_t> values = {5, 6, 7};
+        a.assign(values.begin(), values.end());
+        ASSERT_EQ(3, a.size());
+        EXPECT_EQ(7, as_const(a)[2]);
+        a.assign(c, as_const(a)[0]);
+        ASSERT_EQ(c, a.size());
+        EXPECT_EQ(5, as_const(a)[c - 1]);
+        a.assign({1, 2});
+        ASSERT_EQ(2, a.size());
+        EXPECT_EQ(2, as_const(a)[1]);
+        EXPECT_EQ(old_data, as_const(a).data());
+        EXPECT_EQ(c, a.capacity());
+
+        a.assign(c + 1, 3);
+        ASSERT_EQ(c + 1, a.size());
+        EXPECT_EQ(3, as_const(a)[c]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, compare) {
+    {
+        container a;
+        container b;
+        EXPECT_TRUE(a == b);
+        for (size_t i = 0; i != 5; ++i) {
+            a.push_back(i);
+            b.push_back(i);
+        }
+        EXPECT_TRUE(a == b);
+        EXPECT_FALSE(a != b);
+        b.pop_back();
+        EXPECT_TRUE(a != b);
+        b.push_back(7);
+        EXPECT_FALSE(a == b);
+    }
+    element<size_t>::expect_no_instances();
+
+    socow_vector<int, 2> c = {1, 2, 3};
+    socow_vector<int, 2> d = {1, 2, 4};
+    socow_vector<int, 2> e = {1, 2};
+    EXPECT_TRUE(c < d);
+    EXPECT_TRUE(e < c);
+    EXPECT_TRUE(d > e);
+    EXPECT_TRUE(c <= c);
+    EXPECT_FALSE(d <= c);
+    EXPECT_TRUE(d >= c);
+    d[2] = 3;
+    EXPECT_TRUE(c == d);
+}
+
 TEST(correctness, superfluous_shrink_to_fit) {
     size_t const N = 500;
     {
@@ -424,6 +810,104 @@ TEST(correctness, assignment_operator) {
     element<size_t>::expect_no_instances();
 }
 
+TEST(correctness, move_ctor) {
+    size_t const N = 500;
+    {
+        container a;
+        for (size_t i = 0; i != N; ++i)
+            a.push_back(i);
+
+        element<size_t> const* old_data = as_const(a).data();
+        element<size_t>::set_copy_counter(0);
+        container b = std::move(a);
+        EXPECT_EQ(0, element<size_t>::get_copy_counter());
+        EXPECT_EQ(old_data, as_const(b).data());
+        EXPECT_TRUE(a.empty());
+        EXPECT_EQ(N, b.size());
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(i, as_const(b)[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, move_ctor_small) {
+    {
+        container a;
+        a.push_back(1);
+        a.push_back(2);
+
+        container b = std::move(a);
+        EXPECT_TRUE(a.empty());
+        EXPECT_EQ(2, b.size());
+        EXPECT_EQ(1, b[0]);
+        EXPECT_EQ(2, b[1]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, move_assignment) {
+    size_t const N = 500;
+    {
+        container a;
+        for (size_t i = 0; i != N; ++i)
+            a.push_back(2 * i + 1);
+
+        container b;
+        b.push_back(42);
+
+        container c;
+        for (size_t i = 0; i != N; ++i)
+            c.push_back(i);
+        container d = c;
+
+        b = std::move(a);
+        EXPECT_TRUE(a.empty());
+        EXPECT_EQ(N, b.size());
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(2 * i + 1, as_const(b)[i]);
+
+        b = std::move(c);
+        EXPECT_EQ(as_const(b).data(), as_const(d).data());
+
+        a.push_back(7);
+        b = std::move(a);
+        EXPECT_EQ(1, b.size());
+        EXPECT_EQ(7, b[0]);
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(i, as_const(d)[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, move_self_assignment) {
+    container a;
+    for (size_t i = 0; i != 5; ++i)
+        a.push_back(i);
+    container& b = a;
+    a = std::move(b);
+    EXPECT_EQ(5, a.size());
+    EXPECT_EQ(4, a[4]);
+}
+
+TEST(correctness, nothrow_relocation) {
+    bool test1 =
+        std::is_nothrow_move_constructible<socow_vector<int, 2>>::value;
+    EXPECT_TRUE(test1);
+    EXPECT_FALSE(std::is_nothrow_move_constructible<container>::value);
+
+    std::vector<socow_vector<int, 2>> v;
+    for (int i = 0; i != 100; ++i) {
+        v.emplace_back();
+        for (int j = 0; j != i; ++j)
+            v.back().push_back(j);
+    }
+    for (int i = 0; i != 100; ++i) {
+        ASSERT_EQ(i, v[i].size());
+        for (int j = 0; j != i; ++j)
+            EXPECT_EQ(j, as_const(v[i])[j]);
+    }
+}
+
 TEST(correctness, self_assignment) {
     size_t const N = 500;
     {
@@ -529,6 +1013,40 @@ TEST(correctness, insert_end) {
     element<size_t>::expect_no_instances();
 }
 
+TEST(correctness, emplace_middle) {
+    size_t const N = 500;
+    {
+        container a;
+        for (size_t i = 0; i != N; ++i)
+            a.emplace(as_const(a).begin() + i / 2, i);
+
+        container b;
+        for (size_t i = 0; i != N; ++i)
+            b.insert(b.begin() + i / 2, i);
+
+        EXPECT_EQ(N, a.size());
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(as_const(b)[i], as_const(a)[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, emplace_from_self) {
+    socow_vector<element<size_t>, 3> a;
+    for (size_t i = 0; i != 3; ++i)
+        a.push_back(i + 100);
+
+    for (size_t i = 0; i != 5; ++i)
+        a.emplace(as_const(a).begin(), as_const(a).back());
+
+    EXPECT_EQ(8, a.size());
+    for (size_t i = 0; i != 5; ++i)
+        EXPECT_EQ(102, a[i]);
+    EXPECT_EQ(100, a[5]);
+    EXPECT_EQ(101, a[6]);
+    EXPECT_EQ(102, a[7]);
+}
+
 TEST(performance, insert) {
     const size_t N = 10000;
     socow_vector<socow_vector<size_t, 2>, 2> a;
@@ -561,6 +1079,104 @@ TEST(correctness, insert_empty) {
     EXPECT_EQ(43, v[0]);
 }
 
+TEST(correctness, insert_range) {
+    size_t const N = 50;
+    {
+        std::vector<size_t> expected;
+        container a;
+        for (size_t i = 0; i != N; ++i) {
+            std::vector<size_t> values;
+            for (size_t j = 0; j != i % 7; ++j)
+                values.push_back(i * 10 + j);
+            std::vector<element<size_t>> elements(values.begin(),
+                                                  values.end());
+            size_t index = i == 0 ? 0 : (i * 31) % (a.size() + 1);
+            auto it = a.insert(as_const(a).begin() + index, elements.begin(),
+                               elements.end());
+            EXPECT_EQ(as_const(a).begin() + index, it);
+            expected.insert(expected.begin() + index, values.begin(),
+                            values.end());
+        }
+        ASSERT_EQ(expected.size(), a.size());
+        for (size_t i = 0; i != expected.size(); ++i)
+            EXPECT_EQ(expected[i], as_const(a)[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, insert_count) {
+    {
+        socow_vector<element<size_t>, 3> a;
+        for (size_t i = 0; i != 5; ++i)
+            a.push_back(i);
+        a.insert(as_const(a).begin() + 1, 3, as_const(a)[4]);
+        a.insert(as_const(a).end() - 1, 1, 7);
+        a.insert(as_const(a).begin(), 0, 9);
+
+        size_t expected[] = {0, 4, 4, 4, 1, 2, 3, 7, 4};
+        ASSERT_EQ(9, a.size());
+        for (size_t i = 0; i != 9; ++i)
+            EXPECT_EQ(expected[i], as_const(a)[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, insert_initializer_list) {
+    socow_vector<size_t, 3> a;
+    a.insert(a.cbegin(), {1, 5});
+    a.insert(a.cbegin() + 1, {2, 3, 4});
+    a.insert(a.cend(), {6});
+    ASSERT_EQ(6, a.size());
+    for (size_t i = 0; i != 6; ++i)
+        EXPECT_EQ(i + 1, as_const(a)[i]);
+}
+
+TEST(correctness, insert_input_iterators) {
+    std::istringstream in("1 2 3 4 5");
+    socow_vector<int, 2> a;
+    a.push_back(0);
+    a.push_back(6);
+    a.insert(a.cbegin() + 1, std::istream_iterator<int>(in),
+             std::istream_iterator<int>());
+    ASSERT_EQ(7, a.size());
+    for (int i = 0; i != 7; ++i)
+        EXPECT_EQ(i, as_const(a)[i]);
+}
+
+TEST(correctness, append) {
+    std::list<size_t> values = {1, 2, 3};
+    socow_vector<size_t, 2> a;
+    a.append(values.begin(), values.end());
+    a.append(values.begin(), values.end());
+    ASSERT_EQ(6, a.size());
+    EXPECT_EQ(3, as_const(a)[5]);
+}
+
+TEST(correctness, insert_range_throw) {
+    {
+        container a;
+        a.reserve(10);
+        for (size_t i = 0; i != 6; ++i)
+            a.push_back(i);
+        std::vector<element<size_t>> values(3, 42);
+
+        element<size_t>::set_throw_countdown(2);
+        EXPECT_THROW(a.insert(as_const(a).begin(), values.begin(),
+                              values.end()),
+                     std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+
+        container b = a;
+        element<size_t>::set_throw_countdown(7);
+        EXPECT_THROW(b.insert(as_const(b).begin() + 2, values.begin(),
+                              values.end()),
+                     std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+        EXPECT_EQ(as_const(a).data(), as_const(b).data());
+    }
+    element<size_t>::expect_no_instances();
+}
+
 TEST(correctness, erase) {
     size_t const N = 500;
     {
@@ -735,7 +1351,41 @@ TEST(correctness, erase_4) {
     EXPECT_TRUE(v.empty());
 }
 
-TEST(correctness, reallocation_throw) {
+TEST(correctness, reallocation_moves) {
+    size_t const N = 100;
+    socow_vector<std::string, 2> a;
+    std::vector<char const*> old_data;
+    for (size_t i = 0; i != N; ++i) {
+        a.push_back(std::string(100, 'a' + i % 26));
+        old_data.push_back(a.cdata()[i].data());
+    }
+    a.reserve(2 * N);
+    for (size_t i = 0; i != N; ++i)
+        EXPECT_EQ(old_data[i], a.cdata()[i].data());
+
+    socow_vector<std::string, 2> b = a;
+    b.push_back("");
+    EXPECT_NE(old_data[0], b.cdata()[0].data());
+    EXPECT_EQ(old_data[0], a.cdata()[0].data());
+}
+
+TEST(correctness, trivially_relocatable) {
+    size_t const N = 500;
+    socow_vector<relocatable, 2> a;
+    relocatable::constructions = 0;
+    for (size_t i = 0; i != N; ++i)
+        a.emplace_back(i);
+    a.shrink_to_fit();
+    EXPECT_EQ(0, relocatable::constructions);
+    for (size_t i = 0; i != N; ++i)
+        EXPECT_EQ(i, a.cdata()[i].val);
+
+    socow_vector<relocatable, 2> b = a;
+    b.push_back(N);
+    EXPECT_EQ(N + 1, relocatable::constructions);
+}
+
+TEST(correctness, reallocation_throw) {
     {
         container a;
         a.reserve(10);
@@ -770,6 +1420,257 @@ TEST(correctness, iter_types) {
     EXPECT_TRUE(test2);
 }
 
+TEST(allocator, buffers_use_allocator) {
+    using vector =
+        socow_vector<element<size_t>, 2, socow_plain_refcount,
+                     counting_allocator<element<size_t>>>;
+    allocation_stats stats;
+    {
+        vector a{counting_allocator<element<size_t>>(&stats)};
+        a.push_back(1);
+        a.push_back(2);
+        EXPECT_EQ(0, stats.allocations);
+        for (size_t i = 0; i != 100; ++i)
+            a.push_back(i);
+        EXPECT_LT(0, stats.allocations);
+        EXPECT_LT(100 * sizeof(element<size_t>), stats.live_bytes);
+        EXPECT_EQ(&stats, a.get_allocator().stats);
+    }
+    EXPECT_EQ(stats.allocations, stats.deallocations);
+    EXPECT_EQ(0, stats.live_bytes);
+    element<size_t>::expect_no_instances();
+}
+
+TEST(allocator, range_ctor_allocates_once) {
+    using vector =
+        socow_vector<size_t, 2, socow_plain_refcount,
+                     counting_allocator<size_t>>;
+    allocation_stats stats;
+    {
+        std::list<size_t> values(100, 1);
+        vector a(values.begin(), values.end(),
+                 counting_allocator<size_t>(&stats));
+        EXPECT_EQ(1, stats.allocations);
+        EXPECT_EQ(100, a.capacity());
+        vector b({1, 2}, counting_allocator<size_t>(&stats));
+        vector c(50, 2, counting_allocator<size_t>(&stats));
+        EXPECT_EQ(2, stats.allocations);
+        c.assign(values.begin(), values.end());
+        EXPECT_EQ(3, stats.allocations);
+        EXPECT_EQ(1, stats.deallocations);
+    }
+    EXPECT_EQ(stats.allocations, stats.deallocations);
+}
+
+TEST(allocator, shared_buffer_freed_by_owner) {
+    using vector =
+        socow_vector<element<size_t>, 2, socow_plain_refcount,
+                     counting_allocator<element<size_t>>>;
+    allocation_stats stats_a, stats_b;
+    {
+        vector a{counting_allocator<element<size_t>>(&stats_a)};
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i);
+        size_t allocations = stats_a.allocations;
+
+        vector b(a, counting_allocator<element<size_t>>(&stats_b));
+        EXPECT_NE(as_const(a).data(), as_const(b).data());
+        EXPECT_EQ(1, stats_b.allocations);
+
+        b[0] = 42;
+        EXPECT_EQ(1, stats_b.allocations);
+        EXPECT_EQ(allocations, stats_a.allocations);
+        EXPECT_EQ(0, a[0]);
+        EXPECT_EQ(42, b[0]);
+
+        vector c(a, counting_allocator<element<size_t>>(&stats_a));
+        EXPECT_EQ(as_const(a).data(), as_const(c).data());
+        a = vector{counting_allocator<element<size_t>>(&stats_b)};
+        EXPECT_NE(0, stats_a.live_bytes);
+        c = b;
+        EXPECT_EQ(0, stats_a.live_bytes);
+        EXPECT_EQ(1, stats_b.allocations);
+    }
+    EXPECT_EQ(stats_a.allocations, stats_a.deallocations);
+    EXPECT_EQ(stats_b.allocations, stats_b.deallocations);
+    element<size_t>::expect_no_instances();
+}
+
+TEST(allocator, propagation) {
+    using vector = socow_vector<size_t, 2, socow_plain_refcount,
+                                counting_allocator<size_t>>;
+    allocation_stats stats_a, stats_b;
+    vector a{counting_allocator<size_t>(&stats_a)};
+    vector b{counting_allocator<size_t>(&stats_b)};
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+
+    b = a;
+    EXPECT_EQ(&stats_a, b.get_allocator().stats);
+    b.swap(a);
+    EXPECT_EQ(&stats_a, a.get_allocator().stats);
+
+    vector c{counting_allocator<size_t>(&stats_b)};
+    c = std::move(a);
+    EXPECT_EQ(&stats_b, c.get_allocator().stats);
+    EXPECT_EQ(10, c.size());
+    EXPECT_EQ(1, stats_b.allocations);
+    c.push_back(10);
+    for (size_t i = 0; i != 11; ++i)
+        EXPECT_EQ(i, as_const(c)[i]);
+}
+
+#if __has_include(<memory_resource>)
+TEST(allocator, pmr_monotonic) {
+    std::array<std::byte, 1 << 16> arena;
+    std::pmr::monotonic_buffer_resource resource(
+        arena.data(), arena.size(), std::pmr::null_memory_resource());
+    {
+        socow_pmr_vector<size_t, 4> a(&resource);
+        for (size_t i = 0; i != 1000; ++i)
+            a.push_back(i);
+        socow_pmr_vector<size_t, 4> b = a;
+        EXPECT_EQ(std::pmr::get_default_resource(),
+                  b.get_allocator().resource());
+        EXPECT_NE(a.cdata(), b.cdata());
+        EXPECT_EQ(a, b);
+        socow_pmr_vector<size_t, 4> c(a, &resource);
+        EXPECT_EQ(a.cdata(), c.cdata());
+        c.push_back(1000);
+        for (size_t i = 0; i != 1000; ++i)
+            EXPECT_EQ(i, as_const(c)[i]);
+        EXPECT_EQ(1001, c.size());
+    }
+}
+
+TEST(allocator, pmr_outlives_resource) {
+    std::optional<socow_pmr_vector<size_t, 4>> copied;
+    socow_pmr_vector<size_t, 4> assigned, moved;
+    {
+        std::pmr::monotonic_buffer_resource resource;
+        socow_pmr_vector<size_t, 4> inner(&resource);
+        for (size_t i = 0; i != 100; ++i)
+            inner.push_back(i);
+        socow_pmr_vector<size_t, 4> shared(inner, &resource);
+        copied.emplace(inner);
+        assigned = inner;
+        moved = std::move(shared);
+        EXPECT_EQ(&resource, shared.get_allocator().resource());
+        EXPECT_EQ(inner, moved);
+        EXPECT_NE(inner.cdata(), moved.cdata());
+    }
+    for (size_t i = 0; i != 100; ++i) {
+        EXPECT_EQ(i, copied->cdata()[i]);
+        EXPECT_EQ(i, assigned.cdata()[i]);
+        EXPECT_EQ(i, moved.cdata()[i]);
+    }
+}
+
+TEST(allocator, pmr_snapshot_outlives_resource) {
+    using vector = socow_pmr_vector<size_t, 4, socow_atomic_refcount>;
+    std::optional<vector> thawed;
+    {
+        std::pmr::monotonic_buffer_resource resource;
+        vector inner(&resource);
+        for (size_t i = 0; i != 100; ++i)
+            inner.push_back(i);
+        socow_snapshot<size_t> snapshot = inner.freeze();
+        EXPECT_EQ(snapshot.data(), vector(snapshot, &resource).cdata());
+        thawed.emplace(snapshot);
+        EXPECT_NE(snapshot.data(), thawed->cdata());
+    }
+    for (size_t i = 0; i != 100; ++i)
+        EXPECT_EQ(i, thawed->cdata()[i]);
+}
+
+TEST(allocator, pmr_pinned_reads_share) {
+    std::pmr::monotonic_buffer_resource resource;
+    socow_pmr_vector<size_t, 4> a(&resource);
+    for (size_t i = 0; i != 100; ++i)
+        a.push_back(i);
+    auto pinned = a.pinned_reads();
+    EXPECT_EQ(a.cdata(), pinned.data());
+    a[0] = 1;
+    EXPECT_EQ(0, pinned[0]);
+}
+#endif
+
+TEST(allocator, usable_capacity) {
+    allocation_stats exact_stats;
+    allocation_stats rounding_stats;
+    for (size_t n = 1; n != 200; ++n) {
+        socow_vector<size_t, 2, socow_plain_refcount,
+                     counting_allocator<size_t>>
+            a{counting_allocator<size_t>(&exact_stats)};
+        socow_vector<size_t, 2, socow_plain_refcount,
+                     rounding_allocator<size_t>>
+            b{rounding_allocator<size_t>(&rounding_stats)};
+        for (size_t i = 0; i != n; ++i) {
+            a.push_back(i);
+            b.push_back(i);
+        }
+        if (n == 3) {
+            EXPECT_EQ(4, a.capacity());
+            EXPECT_GT(b.capacity(), 4);
+        }
+        for (size_t i = 0; i != n; ++i)
+            EXPECT_EQ(i, as_const(b)[i]);
+    }
+    EXPECT_LT(rounding_stats.allocations, exact_stats.allocations);
+    EXPECT_EQ(0, rounding_stats.live_bytes);
+}
+
+TEST(allocator, default_usable_capacity) {
+    socow_vector<char, 1> a;
+    for (char c = 'a'; c != 'z'; ++c) {
+        size_t old_capacity = a.capacity();
+        a.push_back(c);
+        EXPECT_GE(a.capacity(), old_capacity);
+    }
+    EXPECT_GE(a.capacity(), a.size());
+    for (char c = 'a'; c != 'z'; ++c)
+        EXPECT_EQ(c, as_const(a)[c - 'a']);
+}
+
+TEST(pool, reuses_blocks) {
+    using vector = socow_vector<element<size_t>, 2, socow_plain_refcount,
+                                socow_pool_allocator<element<size_t>>>;
+    socow_pool& pool = socow_pool::instance();
+    pool.trim();
+    socow_pool_stats before = pool.stats();
+    EXPECT_EQ(0, before.bytes_cached);
+    for (size_t round = 0; round != 10; ++round) {
+        vector a;
+        for (size_t i = 0; i != 100; ++i)
+            a.push_back(i);
+        vector b = a;
+        b.clear();
+        a.pop_back();
+        for (size_t i = 0; i != 99; ++i)
+            EXPECT_EQ(i, as_const(a)[i]);
+    }
+    socow_pool_stats after = pool.stats();
+    EXPECT_LT(before.hits, after.hits);
+    EXPECT_LT(after.misses - before.misses, after.hits - before.hits);
+    EXPECT_LT(0, after.bytes_cached);
+
+    pool.trim();
+    EXPECT_EQ(0, pool.stats().bytes_cached);
+    element<size_t>::expect_no_instances();
+}
+
+TEST(pool, large_blocks_bypass_cache) {
+    socow_pool& pool = socow_pool::instance();
+    pool.trim();
+    {
+        socow_vector<char, 2, socow_plain_refcount, socow_pool_allocator<char>>
+            a;
+        a.reserve(size_t{4} << 20);
+        a.push_back('x');
+    }
+    EXPECT_EQ(0, pool.stats().bytes_cached);
+}
+
 TEST(correctness_cow, copy_ctor) {
     container a;
     for (size_t i = 0; i != 4; ++i)
@@ -931,6 +1832,33 @@ TEST(correctness_cow, pop_back) {
     EXPECT_EQ(103, t);
 }
 
+TEST(correctness_cow, push_back_grow) {
+    container a;
+    a.reserve(5);
+    for (size_t i = 0; i != 5; ++i)
+        a.push_back(i + 100);
+
+    container b = a;
+    element<size_t>::set_copy_counter(0);
+    a.push_back(1);
+    EXPECT_EQ(6, element<size_t>::get_copy_counter());
+    EXPECT_GE(a.capacity(), 6);
+    EXPECT_EQ(5, b.size());
+}
+
+TEST(correctness_cow, pop_back_copies_prefix) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i + 100);
+
+    container b = a;
+    element<size_t>::set_copy_counter(0);
+    a.pop_back();
+    EXPECT_EQ(9, element<size_t>::get_copy_counter());
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+    EXPECT_EQ(10, b.size());
+}
+
 TEST(correctness_cow, reserve) {
     container a;
     a.reserve(5);
@@ -942,6 +1870,19 @@ TEST(correctness_cow, reserve) {
     EXPECT_NE(as_const(a).data(), as_const(b).data());
 }
 
+TEST(correctness_cow, reserve_grow) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i + 100);
+
+    container b = a;
+    element<size_t>::set_copy_counter(0);
+    a.reserve(100);
+    EXPECT_EQ(10, element<size_t>::get_copy_counter());
+    EXPECT_GE(a.capacity(), 100);
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+}
+
 TEST(correctness_cow, shrink_to_fit) {
     container a;
     a.reserve(5);
@@ -979,6 +1920,154 @@ TEST(correctness_cow, clear) {
         EXPECT_EQ(i + 100, b[i]);
 }
 
+TEST(correctness_cow, resize) {
+    {
+        container a;
+        for (size_t i = 0; i != 4; ++i)
+            a.push_back(i + 100);
+
+        container b = a;
+        b.resize(6, 7);
+        container c = a;
+        c.resize(2);
+        EXPECT_EQ(4, a.size());
+        for (size_t i = 0; i != 4; ++i)
+            EXPECT_EQ(i + 100, as_const(a)[i]);
+        EXPECT_EQ(7, as_const(b)[5]);
+        EXPECT_EQ(101, as_const(c)[1]);
+        EXPECT_NE(as_const(a).data(), as_const(c).data());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness_cow, assign) {
+    {
+        container a;
+        for (size_t i = 0; i != 4; ++i)
+            a.push_back(i + 100);
+
+        container b = a;
+        b.assign({1, 2, 3});
+        container c = a;
+        c.assign(1, as_const(c)[3]);
+        ASSERT_EQ(4, a.size());
+        for (size_t i = 0; i != 4; ++i)
+            EXPECT_EQ(i + 100, as_const(a)[i]);
+        EXPECT_EQ(3, as_const(b)[2]);
+        ASSERT_EQ(1, c.size());
+        EXPECT_EQ(103, as_const(c)[0]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness_cow, compare_shared) {
+    container a;
+    for (size_t i = 0; i != 4; ++i)
+        a.push_back(i + 100);
+
+    container b = a;
+    element<size_t>::set_copy_counter(0);
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ(0, element<size_t>::get_copy_counter());
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+
+    socow_snapshot<element<size_t>> x = b.freeze();
+    socow_snapshot<element<size_t>> y = x;
+    EXPECT_TRUE(x == y);
+    EXPECT_FALSE(x != socow_snapshot<element<size_t>>(x));
+    EXPECT_TRUE(x != socow_snapshot<element<size_t>>());
+}
+
+TEST(correctness_cow, compare_shared_nan) {
+    socow_vector<double, 2> a = {1.0, std::nan(""), 3.0};
+    socow_vector<double, 2> b = a;
+    ASSERT_EQ(as_const(a).data(), as_const(b).data());
+    EXPECT_FALSE(a == b);
+    EXPECT_TRUE(a != b);
+    EXPECT_FALSE(a == a);
+    EXPECT_FALSE(a < b);
+    EXPECT_FALSE(b < a);
+    b.pop_back();
+    EXPECT_TRUE(b < a);
+
+    socow_vector<socow_vector<double, 2>, 2> c = {a};
+    socow_vector<socow_vector<double, 2>, 2> d = c;
+    EXPECT_FALSE(c == d);
+
+    socow_snapshot<double> x = a.freeze();
+    socow_snapshot<double> y = x;
+    EXPECT_FALSE(x == y);
+
+    socow_vector<int, 2> e = {1, 2, 3};
+    socow_vector<int, 2> f = e;
+    EXPECT_TRUE(e == f);
+    EXPECT_TRUE(socow_has_reflexive_equality<int>::value);
+    EXPECT_FALSE(socow_has_reflexive_equality<double>::value);
+#ifdef __cpp_lib_three_way_comparison
+    EXPECT_TRUE(std::is_eq(e <=> f));
+    EXPECT_EQ(std::partial_ordering::unordered, a <=> a);
+#endif
+}
+
+TEST(correctness_cow, hash_memoized) {
+    using vector = socow_vector<int, 2, socow_memoized<socow_plain_refcount>>;
+    vector a;
+    for (int i = 0; i != 100; ++i)
+        a.push_back(i);
+    vector b = a;
+
+    size_t calls = 0;
+    auto sum = [&calls](socow_span<int> elements) {
+        ++calls;
+        return static_cast<size_t>(
+            std::accumulate(elements.begin(), elements.end(), 0));
+    };
+    static char const key = 0;
+    std::hash<vector> hash;
+    EXPECT_EQ(4950, a.memo(&key, sum));
+    EXPECT_EQ(4950, b.memo(&key, sum));
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(hash(a), hash(b));
+
+    b[0] = 100;
+    EXPECT_EQ(5050, b.memo(&key, sum));
+    EXPECT_EQ(4950, a.memo(&key, sum));
+    EXPECT_EQ(2, calls);
+    EXPECT_NE(hash(a), hash(b));
+
+    a.pop_back();
+    EXPECT_EQ(4851, a.memo(&key, sum));
+    a[0] = 1;
+    EXPECT_EQ(4852, a.memo(&key, sum));
+    EXPECT_EQ(4, calls);
+
+    vector c = {1, 2};
+    vector d = {1, 2};
+    EXPECT_EQ(hash(c), hash(d));
+
+    socow_vector<int, 2> e(a.begin(), a.end());
+    socow_vector<int, 2> f = e;
+    e.memo(&key, sum);
+    f.memo(&key, sum);
+    EXPECT_EQ(6, calls);
+    std::hash<socow_vector<int, 2>> plain_hash;
+    EXPECT_EQ(hash(a), plain_hash(e));
+}
+
+TEST(correctness_cow, memo_and_held_references) {
+    using vector = socow_vector<int, 2, socow_memoized<socow_plain_refcount>>;
+    std::hash<vector> hash;
+    vector a = {1, 2, 3};
+    int& first = a[0];
+    size_t before = hash(a);
+    first = 5;
+    // The write went through a reference taken before the lookup.
+    EXPECT_EQ(before, hash(a));
+    a[0] = 5;
+    EXPECT_NE(before, hash(a));
+    EXPECT_EQ(hash(vector{5, 2, 3}), hash(a));
+}
+
 TEST(correctness_cow, begin) {
     container a;
     for (size_t i = 0; i != 4; ++i)
@@ -1059,6 +2148,24 @@ TEST(correctness_cow, insert) {
     EXPECT_EQ(104, b[3]);
 }
 
+TEST(correctness_cow, emplace) {
+    container a;
+    a.reserve(5);
+    for (size_t i = 0; i != 4; ++i)
+        a.push_back(i + 100);
+
+    container b = a;
+    a.emplace(as_const(a).begin() + 1, as_const(a)[0]);
+
+    EXPECT_EQ(5, a.size());
+    EXPECT_EQ(100, as_const(a)[0]);
+    EXPECT_EQ(100, as_const(a)[1]);
+    EXPECT_EQ(101, as_const(a)[2]);
+    EXPECT_EQ(4, b.size());
+    EXPECT_EQ(101, as_const(b)[1]);
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+}
+
 TEST(correctness_cow, insert_single_user) {
     container a;
     a.reserve(5);
@@ -1092,6 +2199,149 @@ TEST(correctness_cow, erase) {
     EXPECT_EQ(103, b[4]);
 }
 
+TEST(correctness_cow, insert_range) {
+    container a;
+    a.reserve(10);
+    for (size_t i = 0; i != 4; ++i)
+        a.push_back(i + 100);
+
+    container b = a;
+    std::vector<element<size_t>> values = {1, 2};
+    element<size_t>::set_copy_counter(0);
+    a.insert(as_const(a).begin() + 2, values.begin(), values.end());
+    EXPECT_EQ(6, element<size_t>::get_copy_counter());
+
+    size_t expected[] = {100, 101, 1, 2, 102, 103};
+    for (size_t i = 0; i != 6; ++i)
+        EXPECT_EQ(expected[i], as_const(a)[i]);
+    EXPECT_EQ(4, b.size());
+    EXPECT_EQ(102, as_const(b)[2]);
+}
+
+TEST(correctness_cow, erase_range) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+
+    container b = a;
+    element<size_t>::set_copy_counter(0);
+    a.erase(as_const(a).begin() + 2, as_const(a).begin() + 8);
+    EXPECT_EQ(4, element<size_t>::get_copy_counter());
+
+    size_t expected[] = {0, 1, 8, 9};
+    ASSERT_EQ(4, a.size());
+    for (size_t i = 0; i != 4; ++i)
+        EXPECT_EQ(expected[i], as_const(a)[i]);
+    EXPECT_EQ(10, b.size());
+    EXPECT_EQ(5, as_const(b)[5]);
+}
+
+TEST(correctness_cow, reads) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i + 100);
+
+    container b = a;
+    element<size_t>::set_copy_counter(0);
+    size_t i = 0;
+    for (element<size_t> const& e : a.reads())
+        EXPECT_EQ(100 + i++, e);
+    EXPECT_EQ(10, i);
+    socow_span<element<size_t>> view = b.reads();
+    EXPECT_EQ(10, view.size());
+    EXPECT_EQ(100, view.front());
+    EXPECT_EQ(109, view.back());
+    EXPECT_EQ(view.begin() + 3, std::find(view.begin(), view.end(), 103));
+    EXPECT_EQ(0, element<size_t>::get_copy_counter());
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+}
+
+TEST(correctness_cow, pinned_reads) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i + 100);
+
+    auto pinned = a.pinned_reads();
+    EXPECT_EQ(as_const(a).data(), pinned.data());
+    a[0] = 1;
+    a.clear();
+    EXPECT_EQ(10, pinned.size());
+    socow_span<element<size_t>> view = pinned;
+    for (size_t i = 0; i != 10; ++i)
+        EXPECT_EQ(i + 100, view[i]);
+}
+
+TEST(correctness_cow, pinned_reads_small) {
+    socow_vector<int, 3> a;
+    a.push_back(1);
+    a.push_back(2);
+
+    auto pinned = a.pinned_reads();
+    a[0] = 5;
+    a.push_back(3);
+    EXPECT_EQ(2, pinned.size());
+    EXPECT_EQ(3, std::accumulate(pinned.begin(), pinned.end(), 0));
+}
+
+TEST(correctness_cow, freeze_unique) {
+    {
+        container a;
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i + 100);
+        element<size_t> const* elements = as_const(a).data();
+
+        element<size_t>::set_copy_counter(0);
+        socow_snapshot<element<size_t>> snapshot = a.freeze();
+        EXPECT_EQ(0, element<size_t>::get_copy_counter());
+        EXPECT_EQ(elements, snapshot.data());
+        EXPECT_TRUE(a.empty());
+
+        a.push_back(1);
+        socow_snapshot<element<size_t>> copy = snapshot;
+        snapshot = socow_snapshot<element<size_t>>();
+        EXPECT_EQ(10, copy.size());
+        EXPECT_EQ(109, copy.back());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness_cow, freeze_shared) {
+    {
+        container a;
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i + 100);
+        container b = a;
+
+        socow_snapshot<element<size_t>> snapshot = a.freeze();
+        EXPECT_NE(as_const(b).data(), snapshot.data());
+        b[0] = 1;
+        EXPECT_EQ(100, snapshot.front());
+
+        container thawed(snapshot);
+        EXPECT_NE(snapshot.data(), as_const(thawed).data());
+        thawed.push_back(110);
+        for (size_t i = 0; i != 10; ++i)
+            EXPECT_EQ(i + 100, snapshot[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness_cow, freeze_small) {
+    socow_vector<int, 3> a;
+    EXPECT_TRUE(a.freeze().empty());
+    a.push_back(1);
+    a.push_back(2);
+    socow_snapshot<int> snapshot = a.freeze();
+    EXPECT_TRUE(a.empty());
+    a.push_back(5);
+    ASSERT_EQ(2, snapshot.size());
+    EXPECT_EQ(3, std::accumulate(snapshot.begin(), snapshot.end(), 0));
+
+    socow_vector<int, 3> thawed(snapshot);
+    EXPECT_EQ(2, thawed.size());
+    EXPECT_EQ(3, thawed.capacity());
+}
+
 TEST(correctness_cow, erase_single_user) {
     container a;
     a.reserve(5);
@@ -1242,6 +2492,58 @@ TEST(small_object, swap_two_big) {
     EXPECT_EQ(7, b[2]);
 }
 
+TEST(small_object, swap_two_small_trivial) {
+    socow_vector<size_t, 3> a;
+    a.push_back(1);
+    a.push_back(2);
+
+    socow_vector<size_t, 3> b;
+    b.push_back(3);
+
+    a.swap(b);
+
+    EXPECT_EQ(1, a.size());
+    EXPECT_EQ(2, b.size());
+    EXPECT_EQ(1, b[0]);
+    EXPECT_EQ(2, b[1]);
+    EXPECT_EQ(3, a[0]);
+
+    socow_vector<size_t, 3> c = b;
+    socow_vector<size_t, 3> d = std::move(a);
+    EXPECT_EQ(0, a.size());
+    EXPECT_EQ(2, c.size());
+    EXPECT_EQ(2, c[1]);
+    EXPECT_EQ(1, d.size());
+    EXPECT_EQ(3, d[0]);
+}
+
+TEST(small_object, trivial_unshare_and_grow) {
+    struct pod {
+        size_t a;
+        double b;
+        char c[16];
+    };
+    size_t const N = 500;
+    socow_vector<pod, 3> a;
+    for (size_t i = 0; i != N; ++i)
+        a.push_back(pod{i, 0.5 * i, "pod"});
+
+    socow_vector<pod, 3> b = a;
+    b[0].a = 42;
+    EXPECT_EQ(0, as_const(a)[0].a);
+    for (size_t i = 0; i != N; ++i) {
+        EXPECT_EQ(i == 0 ? 42 : i, as_const(b)[i].a);
+        EXPECT_EQ(0.5 * i, as_const(b)[i].b);
+        EXPECT_STREQ("pod", as_const(b)[i].c);
+    }
+
+    while (b.size() > 2)
+        b.pop_back();
+    b.shrink_to_fit();
+    EXPECT_EQ(3, b.capacity());
+    EXPECT_EQ(1, as_const(b)[1].a);
+}
+
 TEST(small_object, begin_end) {
     socow_vector<element<size_t>, 3> a;
     a.push_back(1);
@@ -1314,3 +2616,435 @@ TEST(small_object, erase_big_into_small_3) {
     EXPECT_THROW(a.erase(as_const(a).begin() + 2, as_const(a).end() - 1),
                  std::runtime_error);
 }
+
+TEST(small_object, compact_header) {
+    using vector = socow_vector<element<size_t>, 2, socow_plain_refcount32>;
+    {
+        vector a;
+        for (size_t i = 0; i != 1000; ++i)
+            a.push_back(i);
+        vector b = a;
+        EXPECT_EQ(as_const(a).data(), as_const(b).data());
+        b.push_back(1000);
+        EXPECT_EQ(1000, a.size());
+        for (size_t i = 0; i != 1000; ++i)
+            EXPECT_EQ(i, as_const(b)[i]);
+
+        EXPECT_THROW(a.reserve(size_t{1} << 33), std::length_error);
+        EXPECT_EQ(1000, a.size());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(small_object, small_size_for) {
+    using vector = socow_vector<int, socow_small_size_for_v<int, 64>>;
+    EXPECT_EQ(64, sizeof(vector));
+    EXPECT_EQ(0, (socow_small_size_for_v<double, sizeof(size_t)>));
+    EXPECT_LE(sizeof(socow_vector<char, socow_small_size_for_v<
+                                            char, 32, socow_plain_refcount,
+                                            counting_allocator<char>>,
+                                  socow_plain_refcount,
+                                  counting_allocator<char>>),
+              32);
+}
+
+TEST(growth, double_by_default) {
+    socow_vector<size_t, 3, socow_plain_refcount, exact_allocator<size_t>> a;
+    std::vector<size_t> capacities;
+    for (size_t i = 0; i != 25; ++i) {
+        a.push_back(i);
+        if (capacities.empty() || capacities.back() != a.capacity())
+            capacities.push_back(a.capacity());
+    }
+    EXPECT_EQ((std::vector<size_t>{3, 6, 12, 24, 48}), capacities);
+}
+
+TEST(growth, factor_1_5x) {
+    socow_vector<size_t, 2, socow_plain_refcount, exact_allocator<size_t>,
+                 socow_growth_1_5x<8>>
+        a;
+    std::vector<size_t> capacities;
+    for (size_t i = 0; i != 28; ++i) {
+        a.push_back(i);
+        if (capacities.empty() || capacities.back() != a.capacity())
+            capacities.push_back(a.capacity());
+    }
+    EXPECT_EQ((std::vector<size_t>{2, 8, 12, 18, 27, 40}), capacities);
+    for (size_t i = 0; i != 28; ++i)
+        EXPECT_EQ(i, as_const(a)[i]);
+}
+
+TEST(growth, insert_range_fits_required) {
+    socow_vector<size_t, 2, socow_plain_refcount, exact_allocator<size_t>,
+                 socow_growth_1_5x<>>
+        a;
+    std::vector<size_t> values(100, 1);
+    a.insert(a.cbegin(), values.begin(), values.end());
+    EXPECT_EQ(100, a.capacity());
+    a.reserve(150);
+    EXPECT_EQ(150, a.capacity());
+}
+
+TEST(growth, size_classes) {
+    allocation_stats stats;
+    using vector =
+        socow_vector<size_t, 2, socow_plain_refcount,
+                     counting_allocator<size_t>,
+                     socow_size_class_growth<socow_growth_1_5x<5>, 1>>;
+    {
+        vector a{counting_allocator<size_t>(&stats)};
+        for (size_t i = 0; i != 1000; ++i) {
+            a.push_back(i);
+            EXPECT_EQ(0, stats.live_bytes & (stats.live_bytes - 1));
+        }
+        a.reserve(3000);
+        EXPECT_GE(a.capacity(), 3000);
+        EXPECT_EQ(0, stats.live_bytes & (stats.live_bytes - 1));
+    }
+    EXPECT_EQ(0, stats.live_bytes);
+}
+
+TEST(growth, size_class_boundaries) {
+    using growth = socow_size_class_growth<>;
+    // Four classes per power of two: 80, 96, 112, 128, then 160, 192, ...
+    size_t const expected[][2] = {
+        {1, 16},     {17, 32},    {65, 80},     {70, 80},
+        {81, 96},    {100, 112},  {128, 128},   {129, 160},
+        {200, 224},  {256, 256},  {257, 320},   {1000, 1024},
+        {1025, 1280}};
+    for (auto const& [bytes, rounded] : expected)
+        EXPECT_EQ(rounded, growth::fit(bytes, 0, 1)) << bytes;
+    // The header counts toward the class: 16 + 3 * 8 bytes round to 48.
+    EXPECT_EQ(4, growth::fit(3, 16, 8));
+}
+
+TEST(chunked, push_back_and_index) {
+    {
+        socow_chunked_vector<element<size_t>, 4> a;
+        for (size_t i = 0; i != 50; ++i)
+            a.push_back(i);
+        a.push_back(a[3]);
+        ASSERT_EQ(51, a.size());
+        for (size_t i = 0; i != 50; ++i)
+            EXPECT_EQ(i, as_const(a)[i]);
+        EXPECT_EQ(3, a.back());
+        a[10] = 100;
+        EXPECT_EQ(100, as_const(a)[10]);
+
+        for (size_t i = 0; i != 47; ++i)
+            a.pop_back();
+        ASSERT_EQ(4, a.size());
+        EXPECT_EQ(3, as_const(a).back());
+        a.clear();
+        EXPECT_TRUE(a.empty());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(chunked, write_copies_one_chunk) {
+    {
+        socow_chunked_vector<element<size_t>, 8> a;
+        for (size_t i = 0; i != 100; ++i)
+            a.push_back(i);
+
+        element<size_t>::set_copy_counter(0);
+        socow_chunked_vector<element<size_t>, 8> b = a;
+        EXPECT_EQ(0, element<size_t>::get_copy_counter());
+        b[42] = 1;
+        EXPECT_EQ(8 + 1, element<size_t>::get_copy_counter());
+        EXPECT_EQ(42, as_const(a)[42]);
+        EXPECT_EQ(1, as_const(b)[42]);
+        EXPECT_EQ(&as_const(a)[0], &as_const(b)[0]);
+        EXPECT_EQ(&as_const(a)[99], &as_const(b)[99]);
+
+        b.push_back(100);
+        EXPECT_EQ(100, a.size());
+        EXPECT_EQ(101, b.size());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(chunked, iteration) {
+    socow_chunked_vector<int, 4> a;
+    for (int i = 0; i != 30; ++i)
+        a.push_back(i);
+    socow_chunked_vector<int, 4> b = a;
+
+    int expected = 0;
+    for (int value : b)
+        EXPECT_EQ(expected++, value);
+    EXPECT_EQ(30, expected);
+    EXPECT_EQ(&as_const(a)[0], &as_const(b)[0]);
+
+    EXPECT_EQ(30, b.end() - b.begin());
+    EXPECT_EQ(435, std::accumulate(b.begin(), b.end(), 0));
+    EXPECT_EQ(b.begin() + 17, std::lower_bound(b.begin(), b.end(), 17));
+    auto it = b.end();
+    for (int i = 29; i >= 0; --i)
+        EXPECT_EQ(i, *--it);
+    EXPECT_EQ(b.begin(), it);
+}
+
+TEST(chunked, reuse_after_move) {
+    socow_chunked_vector<int, 4> a;
+    for (int i = 0; i != 10; ++i)
+        a.push_back(i);
+    socow_chunked_vector<int, 4> b = std::move(a);
+    EXPECT_EQ(10, b.size());
+    EXPECT_EQ(0, a.size());
+    EXPECT_TRUE(a.empty());
+    a.push_back(1);
+    EXPECT_EQ(1, as_const(a).back());
+
+    b = std::move(a);
+    EXPECT_EQ(1, b.size());
+    EXPECT_EQ(0, a.size());
+    a.push_back(2);
+    EXPECT_EQ(2, as_const(a)[0]);
+}
+
+namespace {
+
+struct record {
+    int64_t id;
+    double value;
+    char tag[4];
+};
+
+} // namespace
+
+TEST(serialization, round_trip) {
+    socow_vector<int64_t, 4> small = {1, -2, 3};
+    socow_vector<int64_t, 4> big;
+    for (int64_t i = 0; i != 1000; ++i)
+        big.push_back(i * i);
+    socow_vector<int64_t, 4> empty;
+
+    for (auto const* source : {&small, &big, &empty}) {
+        auto serialized = socow_serialize(*source);
+        size_t header_bytes = sizeof(socow_wire_header);
+        size_t payload_bytes = sizeof(int64_t) * serialized.header().size;
+        std::vector<char> bytes(header_bytes + payload_bytes);
+        std::memcpy(bytes.data(), &serialized.header(), header_bytes);
+        if (payload_bytes != 0)
+            std::memcpy(bytes.data() + header_bytes, serialized.payload(),
+                        payload_bytes);
+        auto result = socow_deserialize<socow_vector<int64_t, 4>>(
+            bytes.data(), bytes.size());
+        EXPECT_TRUE(result == *source);
+    }
+}
+
+TEST(serialization, records_through_stream) {
+    socow_vector<record, 2> a;
+    for (int64_t i = 0; i != 10; ++i)
+        a.push_back({i, i / 2.0, {'a', 'b', 'c', 'd'}});
+    std::stringstream stream;
+    socow_serialize(a).write(stream);
+    socow_serialize(socow_vector<record, 2>()).write(stream);
+
+    auto b = socow_deserialize<socow_vector<record, 2>>(stream);
+    auto c = socow_deserialize<socow_vector<record, 2>>(stream);
+    ASSERT_EQ(10, b.size());
+    EXPECT_TRUE(c.empty());
+    for (size_t i = 0; i != 10; ++i) {
+        EXPECT_EQ(static_cast<int64_t>(i), as_const(b)[i].id);
+        EXPECT_EQ(i / 2.0, as_const(b)[i].value);
+        EXPECT_EQ('d', as_const(b)[i].tag[3]);
+    }
+    using vector = socow_vector<record, 2>;
+    EXPECT_THROW(socow_deserialize<vector>(stream), std::invalid_argument);
+}
+
+TEST(serialization, single_allocation) {
+    using vector = socow_vector<int64_t, 2, socow_plain_refcount,
+                                counting_allocator<int64_t>>;
+    allocation_stats stats;
+    vector a{counting_allocator<int64_t>(&stats)};
+    for (int64_t i = 0; i != 100; ++i)
+        a.push_back(i);
+    std::stringstream stream;
+    socow_serialize(a).write(stream);
+
+    size_t before = stats.allocations;
+    auto serialized = socow_serialize(a);
+    EXPECT_EQ(before, stats.allocations);
+    EXPECT_EQ(as_const(a).data(), serialized.payload());
+    a[0] = 42;
+    EXPECT_EQ(0, static_cast<int64_t const*>(serialized.payload())[0]);
+
+    before = stats.allocations;
+    vector b =
+        socow_deserialize<vector>(stream, counting_allocator<int64_t>(&stats));
+    EXPECT_EQ(before + 1, stats.allocations);
+    ASSERT_EQ(100, b.size());
+    EXPECT_EQ(100, b.capacity());
+    EXPECT_EQ(99, as_const(b)[99]);
+}
+
+#if __has_include(<memory_resource>)
+TEST(serialization, zero_copy_with_pmr) {
+    std::pmr::monotonic_buffer_resource resource;
+    socow_pmr_vector<int64_t, 2> a(&resource);
+    for (int64_t i = 0; i != 100; ++i)
+        a.push_back(i);
+    auto serialized = socow_serialize(a);
+    EXPECT_EQ(a.cdata(), serialized.payload());
+}
+#endif
+
+TEST(serialization, rejects_bad_headers) {
+    socow_vector<int32_t, 2> a = {1, 2, 3};
+    auto serialized = socow_serialize(a);
+    std::vector<char> bytes(serialized.size());
+    std::memcpy(bytes.data(), &serialized.header(), 16);
+    std::memcpy(bytes.data() + 16, serialized.payload(), 12);
+
+    using vector = socow_vector<int32_t, 2>;
+    EXPECT_THROW(socow_deserialize<vector>(bytes.data(), 10),
+                 std::invalid_argument);
+    EXPECT_THROW(socow_deserialize<vector>(bytes.data(), 20),
+                 std::invalid_argument);
+    using wide = socow_vector<int64_t, 2>;
+    EXPECT_THROW(socow_deserialize<wide>(bytes.data(), bytes.size()),
+                 std::invalid_argument);
+    uint32_t swapped = socow_wire_header::SWAPPED_MAGIC;
+    std::memcpy(bytes.data() + 12, &swapped, 4);
+    EXPECT_THROW(socow_deserialize<vector>(bytes.data(), bytes.size()),
+                 std::invalid_argument);
+}
+
+#if defined(SOCOW_HAS_IOVEC) && defined(__unix__)
+TEST(serialization, writev) {
+    socow_vector<int64_t, 2> a;
+    for (int64_t i = 0; i != 500; ++i)
+        a.push_back(-i);
+    auto serialized = socow_serialize(a);
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    auto iovecs = serialized.iovecs();
+    ssize_t written = writev(fds[1], iovecs.data(), iovecs.size());
+    close(fds[1]);
+    ASSERT_EQ(static_cast<ssize_t>(serialized.size()), written);
+
+    std::vector<char> bytes(serialized.size());
+    size_t total = 0;
+    for (ssize_t n; (n = read(fds[0], bytes.data() + total,
+                              bytes.size() - total)) > 0;)
+        total += n;
+    close(fds[0]);
+    ASSERT_EQ(bytes.size(), total);
+    auto b = socow_deserialize<socow_vector<int64_t, 2>>(bytes.data(), total);
+    EXPECT_TRUE(a == b);
+}
+#endif
+
+#ifdef __linux__
+namespace {
+
+size_t remaps = 0;
+
+// Counts the buffers grown or shrunk through reallocate_at_least.
+template <typename T>
+struct remap_counting_allocator : socow_mmap_allocator<T, 4096> {
+    template <typename U>
+    struct rebind {
+        using other = remap_counting_allocator<U>;
+    };
+
+    remap_counting_allocator() = default;
+
+    template <typename U>
+    remap_counting_allocator(remap_counting_allocator<U> const&) {}
+
+    socow_allocation_result<T*> reallocate_at_least(T* p, size_t old_count,
+                                                    size_t new_count) {
+        ++remaps;
+        return socow_mmap_allocator<T, 4096>::reallocate_at_least(
+            p, old_count, new_count);
+    }
+};
+
+} // namespace
+
+TEST(mmap, grows_in_place) {
+    using vector = socow_vector<int, 4, socow_plain_refcount,
+                                socow_mmap_allocator<int, 4096>>;
+    vector a;
+    for (int i = 0; i != 1000; ++i)
+        a.push_back(i);
+    EXPECT_LT(1000, a.capacity());
+    vector b = a;
+    for (int i = 1000; i != 2000000; ++i)
+        a.push_back(i);
+    ASSERT_EQ(2000000, a.size());
+    for (int i = 0; i != 2000000; ++i)
+        ASSERT_EQ(i, as_const(a)[i]);
+    ASSERT_EQ(1000, b.size());
+    EXPECT_EQ(999, as_const(b)[999]);
+
+    std::vector<int> values(3000000, 7);
+    a.append(values.begin(), values.end());
+    EXPECT_EQ(5000000, a.size());
+    EXPECT_EQ(7, as_const(a)[4999999]);
+    a.resize(10);
+    a.shrink_to_fit();
+    EXPECT_EQ(10, a.capacity());
+    EXPECT_EQ(9, as_const(a)[9]);
+}
+
+TEST(mmap, resize_and_reserve_grow_in_place) {
+    using vector = socow_vector<int, 4, socow_plain_refcount,
+                                remap_counting_allocator<int>>;
+    vector a;
+    a.resize(1000);
+    size_t before = remaps;
+    a.resize(a.capacity() + 1);
+    EXPECT_EQ(before + 1, remaps);
+    size_t n = a.capacity() + 1;
+    a.resize(n, 7);
+    EXPECT_EQ(before + 2, remaps);
+    a.reserve(a.capacity() + 1);
+    EXPECT_EQ(before + 3, remaps);
+    EXPECT_EQ(0, as_const(a)[999]);
+    EXPECT_EQ(7, as_const(a)[n - 1]);
+
+    vector b = a;
+    b.resize(b.capacity() + 1);
+    EXPECT_EQ(before + 3, remaps);
+    EXPECT_EQ(7, as_const(b)[n - 1]);
+}
+
+TEST(mmap, memo_forgotten_when_growing_in_place) {
+    using vector = socow_vector<int, 4, socow_memoized<socow_plain_refcount>,
+                                socow_mmap_allocator<int, 4096>>;
+    std::hash<vector> hash;
+    vector a;
+    for (int i = 0; i != 2000; ++i)
+        a.push_back(i);
+    while (a.size() != a.capacity())
+        a.push_back(0);
+    size_t before = hash(a);
+    a.push_back(1);
+    EXPECT_NE(before, hash(a));
+    EXPECT_EQ(hash(vector(a.cbegin(), a.cend())), hash(a));
+}
+
+TEST(mmap, elements_not_relocatable) {
+    {
+        using vector =
+            socow_vector<element<size_t>, 2, socow_plain_refcount,
+                         socow_mmap_allocator<element<size_t>, 4096>>;
+        vector a;
+        for (size_t i = 0; i != 2000; ++i)
+            a.push_back(i);
+        vector b = a;
+        b.push_back(2000);
+        for (size_t i = 0; i != 2001; ++i)
+            ASSERT_EQ(i, as_const(b)[i]);
+        EXPECT_EQ(2000, a.size());
+    }
+    element<size_t>::expect_no_instances();
+}
+#endif